@@ -23,6 +23,9 @@
 #include "fs.h"
 #include "buf.h"
 
+#define NBHASH 64
+#define BHASH(dev, blockno) (((dev) * 31 + (blockno)) % NBHASH)
+
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
@@ -31,6 +34,10 @@ struct {
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+
+  // Buffers that hold a block, by dev and blockno, through hnext.
+  struct buf *hash[NBHASH];
+  int nfree;  // buffers with refcnt 0
 } bcache;
 
 void
@@ -50,6 +57,38 @@ binit(void)
     bcache.head.next->prev = b;
     bcache.head.next = b;
   }
+  bcache.nfree = NBUF;
+}
+
+static struct buf*
+bfind(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bcache.hash[BHASH(dev, blockno)]; b != 0; b = b->hnext)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Give the free buffer b to block blockno. Caller holds bcache.lock.
+static void
+bassign(struct buf *b, uint dev, uint blockno)
+{
+  struct buf **pp;
+
+  // unhash, if it held a block
+  for(pp = &bcache.hash[BHASH(b->dev, b->blockno)]; *pp != 0 && *pp != b; pp = &(*pp)->hnext)
+    ;
+  if(*pp)
+    *pp = b->hnext;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  bcache.nfree--;
+  b->hnext = bcache.hash[BHASH(dev, blockno)];
+  bcache.hash[BHASH(dev, blockno)] = b;
 }
 
 // Look through buffer cache for block on device dev.
@@ -63,23 +102,19 @@ bget(uint dev, uint blockno)
   acquire(&bcache.lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = bfind(dev, blockno)) != 0){
+    if(b->refcnt++ == 0)
+      bcache.nfree--;
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
   }
 
   // Not cached.
   // Recycle the least recently used (LRU) unused buffer.
   for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
     if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+      bassign(b, dev, blockno);
       release(&bcache.lock);
       acquiresleep(&b->lock);
       return b;
@@ -102,6 +137,66 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for blockno without reading it from
+// disk, for a caller that will overwrite all of it.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->valid = 1;
+  return b;
+}
+
+// Read up to n blocks starting at blockno into the cache, in
+// one disk request unless others load some of them meanwhile.
+// Stops at the first block that is already cached, and leaves half the buffers free for everyone else,
+// so it never waits for a free buffer.
+void
+breadahead(uint dev, uint blockno, int n)
+{
+  struct buf *b, *bs[MAXIOBLOCKS];
+  int i, j, k, m;
+
+  if(n > MAXIOBLOCKS)
+    n = MAXIOBLOCKS;
+
+  acquire(&bcache.lock);
+  if(n > bcache.nfree - NBUF/2)
+    n = bcache.nfree - NBUF/2;
+
+  for(k = 0; k < n; k++){
+    if(bfind(dev, blockno + k) != 0)
+      break;
+    for(b = bcache.head.prev; b->refcnt != 0; b = b->prev)
+      ;
+    bassign(b, dev, blockno + k);
+    bs[k] = b;
+  }
+  release(&bcache.lock);
+
+  // once bcache.lock is released bget() can find the bufs and
+  // lock them first; such a buf may already be read, or written
+  // by bnew() and log_write(), so skip the valid ones and read
+  // each run of bufs that are still invalid.
+  for(i = 0; i < k; i = j){
+    for(j = i; j < k; j++){
+      acquiresleep(&bs[j]->lock);
+      if(bs[j]->valid)
+        break;
+    }
+    if(j > i)
+      virtio_disk_rwv(bs+i, j-i, 0);
+    for(m = i; m < j; m++){
+      bs[m]->valid = 1;
+      brelse(bs[m]);
+    }
+    if(j < k)
+      brelse(bs[j++]);
+  }
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,6 +206,33 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write the locked bufs b[0..n-1] to disk: to blocks to, to+1, ...
+// or, if to is 0, each to its own block. Consecutive blocks go in
+// one request, and all the requests are started before waiting
+// for any, so the disk sees them together.
+void
+bwritev(struct buf **b, int n, uint to)
+{
+  int i, j, pass;
+
+  for(i = 0; i < n; i++)
+    if(!holdingsleep(&b[i]->lock))
+      panic("bwritev");
+
+  // pass 0 starts the requests, pass 1 waits for the same ones
+  for(pass = 0; pass < 2; pass++){
+    for(i = 0; i < n; i = j){
+      for(j = i+1; j < n && j-i < MAXIOBLOCKS; j++)
+        if(to == 0 && b[j]->blockno != b[j-1]->blockno + 1)
+          break;
+      if(pass == 0)
+        virtio_disk_start(b+i, j-i, to ? to+i : b[i]->blockno, 1);
+      else
+        virtio_disk_wait(b[i]);
+    }
+  }
+}
+
 // Release a locked buffer.
 // Move to the head of the most-recently-used list.
 void
@@ -125,6 +247,7 @@ brelse(struct buf *b)
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
+    bcache.nfree++;
     b->next->prev = b->prev;
     b->prev->next = b->next;
     b->next = bcache.head.next;
@@ -146,7 +269,8 @@ bpin(struct buf *b) {
 void
 bunpin(struct buf *b) {
   acquire(&bcache.lock);
-  b->refcnt--;
+  if(--b->refcnt == 0)
+    bcache.nfree++;
   release(&bcache.lock);
 }
 
@@ -7,6 +7,7 @@ struct buf {
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
+  struct buf *hnext; // hash chain
   uchar data[BSIZE];
 };
 
@@ -12,8 +12,11 @@ struct superblock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bnew(uint, uint);
+void            breadahead(uint, uint, int);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int, uint);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
@@ -34,10 +37,13 @@ struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
+int             fileseek(struct file*, int, int);
 int             filewrite(struct file*, uint64, int n);
 
 // fs.c
 void            fsinit(int);
+void            dcacheinit(void);
+void            dirforget(struct inode*, char*);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
@@ -70,7 +76,9 @@ void            kinit(void);
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
+int             begin_opn(int);
 void            end_op(void);
+void            end_opn(int);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
@@ -126,6 +134,9 @@ void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// membench.c
+void            membench(void);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -185,6 +196,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwv(struct buf **, int, int);
+void            virtio_disk_start(struct buf **, int, uint, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
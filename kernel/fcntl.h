@@ -3,3 +3,7 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+
+#define SEEK_SET  0
+#define SEEK_CUR  1
+#define SEEK_END  2
@@ -12,6 +12,7 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "fcntl.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -101,6 +102,39 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Set the offset of file f used by the next read or write.
+// Returns the new offset, or -1 if f is not an inode.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  int base;
+
+  if(f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  switch(whence){
+  case SEEK_SET:
+    base = 0;
+    break;
+  case SEEK_CUR:
+    base = f->off;
+    break;
+  case SEEK_END:
+    base = f->ip->size;
+    break;
+  default:
+    iunlock(f->ip);
+    return -1;
+  }
+  if(base + off < 0){
+    iunlock(f->ip);
+    return -1;
+  }
+  f->off = base + off;
+  iunlock(f->ip);
+  return f->off;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -146,25 +180,25 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write as many blocks at a time as the log will
+    // reserve for one transaction, including i-node,
+    // indirect blocks, allocation blocks, and 2 blocks
+    // of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
+      int nop = begin_opn(2*((uint64)n1/BSIZE + 1) + 1+1+2);
+      int max = ((nop-1-1-2) / 2) * BSIZE;
       if(n1 > max)
         n1 = max;
 
-      begin_op();
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      end_opn(nop);
 
       if(r != n1){
         // error from writei
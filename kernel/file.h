@@ -13,11 +13,16 @@ struct file {
 #define minor(dev)  ((dev) & 0xFFFF)
 #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
 
+#define NMAP 32  // indirect block entries cached in struct inode
+
 // in-memory copy of an inode
 struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // hash chain
+  struct inode *prev; // LRU list of unreferenced inodes
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +31,18 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  // a window of the indirect block last used by bmap():
+  // file blocks mapbn..mapbn+mapn-1 are at map[0..mapn-1]
+  uint mapbn;
+  uint mapn;
+  uint map[NMAP];
+
+  uint resv;          // next block for this file, see iballoc()
+  uint resvn;         // blocks resv.. reserved; protected by itable.lock
+  uint rdoff;         // where the last readi() ended
+  uint rabn;          // file blocks before rabn have been read ahead
 };
 
 // map major device number to device functions.
@@ -22,6 +22,7 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define NRESV 32  // blocks reserved at a time for a growing file
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -37,13 +38,20 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+static void bsuminit(uint);
+
 // Init fs
 void
 fsinit(int dev) {
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
+  if(sb.bsize == 0)
+    panic("file system image predates this format, rerun mkfs");
+  if(sb.bsize != BSIZE)
+    panic("file system block size is not BSIZE");
   initlog(dev, &sb);
+  bsuminit(dev);
 }
 
 // Zero a block.
@@ -59,31 +67,108 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// bsum keeps the number of free blocks under each bitmap block,
+// so allocation skips full parts of the disk without reading
+// them, and a next-fit cursor where new files start looking.
+// It is built from the bitmap at mount, after log recovery, and
+// balloc() and bfree() change it along with the bitmap. Since a
+// transaction never aborts, the bitmap in the buffer cache is
+// what will be on disk, and the counts match it.
+//
+// bsum.lock guards every write. nfree[] and total are read
+// without it as hints: the bitmap, read under the buffer lock,
+// has the final say, and a stale count only makes a search
+// look at one bitmap block more or fewer. cursor and norun are
+// decisions rather than hints and are used under the lock.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
-static uint
-balloc(uint dev)
+struct {
+  struct spinlock lock;
+  uint *nfree;    // free blocks per bitmap block, a kalloc page
+  uint total;     // free blocks on the disk
+  uint cursor;    // where the last allocation ended
+  int norun;      // no free run for a reservation since the last bfree
+  uint nfreed;    // bfree() calls, to see one came during a search
+} bsum;
+
+// Count the free blocks in the bitmap.
+static void
+bsuminit(uint dev)
 {
-  int b, bi, m;
+  uint b, bi;
   struct buf *bp;
 
-  bp = 0;
+  initlock(&bsum.lock, "bsum");
+  if(sb.size / BPB + 1 > PGSIZE / sizeof(uint))
+    panic("bsuminit: bitmap too big");
+  if((bsum.nfree = kalloc()) == 0)
+    panic("bsuminit");
+  memset(bsum.nfree, 0, PGSIZE);
+  bsum.total = 0;
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[b / BPB]++;
+    brelse(bp);
+    bsum.total += bsum.nfree[b / BPB];
+  }
+  bsum.cursor = 0;
+  bsum.norun = 0;
+  bsum.nfreed = 0;
+}
+
+// Account for block b going in use (n = -1) or free (n = 1).
+static void
+bsumadd(uint b, int n)
+{
+  acquire(&bsum.lock);
+  bsum.nfree[b / BPB] += n;
+  bsum.total += n;
+  if(n < 0){
+    bsum.cursor = b + 1;
+  } else {
+    bsum.norun = 0;
+    bsum.nfreed++;
+  }
+  release(&bsum.lock);
+}
+
+// Allocate a zeroed disk block, the first free one in [from, to).
+// returns 0 if there is none.
+static uint
+balloc(uint dev, uint from, uint to)
+{
+  uint b, bi, end, m;
+  struct buf *bp;
+
+  if(to > sb.size)
+    to = sb.size;
+  for(b = from; b < to; ){
+    if(bsum.nfree[b / BPB] == 0){
+      b = b - b % BPB + BPB;  // nothing free under this bitmap block
+      continue;
+    }
+    bp = bread(dev, BBLOCK(b, sb));
+    end = min(to, b - b % BPB + BPB);
+    for(; b < end; b++){
+      bi = b % BPB;
+      if(bi % 8 == 0 && b + 8 <= end && bp->data[bi/8] == 0xff){
+        b += 7;  // all eight in use
+        continue;
+      }
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
+        bsumadd(b, -1);
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+        bzero(dev, b);
+        return b;
       }
     }
     brelse(bp);
   }
-  printf("balloc: out of blocks\n");
   return 0;
 }
 
@@ -100,6 +185,7 @@ bfree(int dev, uint b)
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
+  bsumadd(b, 1);
   log_write(bp);
   brelse(bp);
 }
@@ -170,26 +256,74 @@ bfree(int dev, uint b)
 // holds, one must hold itable.lock while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// dev, inum, the hash and LRU links, and the block reservation
+// (resv, resvn), which other inodes' allocations look at under
+// itable.lock. One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// Entries are found through a hash table on (dev, inum). An
+// entry whose ref falls to zero stays in the hash table, valid,
+// on an LRU list, so the next iget() of the same inode does not
+// read the disk again; iget() recycles the least recently used
+// one. The table starts with NINODE entries and grows a page
+// at a time from kalloc() when every entry is referenced.
+
+#define NIHASH 64
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
 
 struct {
   struct spinlock lock;
+  struct inode *hash[NIHASH];
+
+  // Linked list of unreferenced entries, through prev/next.
+  // lru.next is the least recently used.
+  struct inode lru;
+
   struct inode inode[NINODE];
 } itable;
 
+// Add a new entry to the table, first in line to be used.
+static void
+inew(struct inode *ip)
+{
+  initsleeplock(&ip->lock, "inode");
+  ip->dev = ip->inum = 0;   // not in the hash table
+  ip->ref = 0;
+  ip->next = itable.lru.next;
+  ip->prev = &itable.lru;
+  itable.lru.next->prev = ip;
+  itable.lru.next = ip;
+}
+
+// Grow the table by a page of entries.
+// Caller must hold itable.lock.
+static void
+igrow(void)
+{
+  struct inode *ip;
+  char *pa;
+
+  if((pa = kalloc()) == 0)
+    panic("iget: no inodes");
+  for(ip = (struct inode*)pa; ip + 1 <= (struct inode*)(pa + PGSIZE); ip++)
+    inew(ip);
+}
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&itable.lock, "itable");
+  itable.lru.prev = &itable.lru;
+  itable.lru.next = &itable.lru;
   for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+    inew(&itable.inode[i]);
   }
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void dirpurge(uint dev, uint inum);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -246,31 +380,42 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.hash[IHASH(dev, inum)]; ip != 0; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0){
+        // off the LRU list; its contents are still valid
+        ip->next->prev = ip->prev;
+        ip->prev->next = ip->next;
+      }
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Recycle the least recently used unreferenced entry.
+  if(itable.lru.next == &itable.lru)
+    igrow();
+  ip = itable.lru.next;
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+  if(ip->inum != 0){
+    for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->resv = ip->resvn = 0;
+  ip->hnext = itable.hash[IHASH(dev, inum)];
+  itable.hash[IHASH(dev, inum)] = ip;
   release(&itable.lock);
 
   return ip;
@@ -310,6 +455,8 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->mapn = 0;
+    ip->rdoff = ip->rabn = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -347,6 +494,8 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
+    if(ip->type == T_DIR)
+      dirpurge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -358,6 +507,14 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0){
+    // keep the contents, most recently used
+    ip->resvn = 0;
+    ip->next = &itable.lru;
+    ip->prev = itable.lru.prev;
+    itable.lru.prev->next = ip;
+    itable.lru.prev = ip;
+  }
   release(&itable.lock);
 }
 
@@ -374,7 +531,153 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. Block ip->addrs[NDIRECT+1]
+// lists NINDIRECT more indirect blocks for the NDINDIRECT after that.
+//
+// bmap() keeps a copy of part of the last indirect block it
+// read in ip->map, so sequential access reads each indirect
+// block once per NMAP data blocks rather than once per block.
+
+// Blocks for a growing file come from a run of NRESV free blocks
+// that the inode reserves in memory, so files written at the same
+// time do not interleave and a file's blocks stay contiguous.
+// Nothing about a reservation is on disk, and it lasts while the
+// inode is in the table.
+
+// Reserve [start, start+n) for ip unless it overlaps another
+// inode's reservation. Returns 0 if it did, else the end of the
+// overlapping reservation.
+static uint
+reserve(struct inode *ip, uint start, uint n)
+{
+  struct inode *p;
+  int i;
+
+  acquire(&itable.lock);
+  for(i = 0; i < NIHASH; i++){
+    for(p = itable.hash[i]; p != 0; p = p->hnext){
+      if(p != ip && p->resvn > 0 &&
+         p->resv < start + n && start < p->resv + p->resvn){
+        release(&itable.lock);
+        return p->resv + p->resvn;
+      }
+    }
+  }
+  ip->resv = start;
+  ip->resvn = n;
+  release(&itable.lock);
+  return 0;
+}
+
+// Find and reserve for ip a run of NRESV free blocks in [from, to).
+// Returns its first block, or 0 if there is none.
+static uint
+freerun(struct inode *ip, uint from, uint to)
+{
+  uint b, bi, start, next, bblock;
+  struct buf *bp;
+
+  bp = 0;
+  start = from;
+  for(b = from; b < to; b++){
+    if(bsum.nfree[b / BPB] == 0){
+      b = b - b % BPB + BPB - 1;
+      start = b + 1;
+      continue;
+    }
+    if(bp == 0 || BBLOCK(b, sb) != bblock){
+      if(bp)
+        brelse(bp);
+      bblock = BBLOCK(b, sb);
+      bp = bread(ip->dev, bblock);
+    }
+    bi = b % BPB;
+    if(bp->data[bi/8] & (1 << (bi % 8))){
+      start = b + 1;
+      continue;
+    }
+    if(b + 1 - start < NRESV)
+      continue;
+    if((next = reserve(ip, start, NRESV)) == 0){
+      brelse(bp);
+      return start;
+    }
+    start = next;
+    b = next - 1;
+  }
+  if(bp)
+    brelse(bp);
+  return 0;
+}
+
+// Allocate a zeroed block for ip: the next one of its
+// reservation, else the first of a new reservation found from
+// there on (or from the cursor for a new file), else any free
+// block.
+// returns 0 if out of disk space.
+static uint
+iballoc(struct inode *ip)
+{
+  uint b, goal, start, freed;
+  int norun;
+
+  if(bsum.total == 0){
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+
+  b = 0;
+  goal = ip->resv;
+  acquire(&bsum.lock);
+  if(goal == 0)
+    goal = bsum.cursor;  // a new file: next fit
+  norun = bsum.norun;
+  freed = bsum.nfreed;
+  release(&bsum.lock);
+  if(ip->resvn > 0)
+    b = balloc(ip->dev, goal, goal + 1);
+  if(b == 0 && !norun){
+    if((start = freerun(ip, goal, sb.size)) != 0 ||
+       (start = freerun(ip, 0, goal)) != 0){
+      b = balloc(ip->dev, start, start + 1);
+    } else {
+      // unless a bfree() during the search may have made a run
+      acquire(&bsum.lock);
+      if(bsum.nfreed == freed)
+        bsum.norun = 1;
+      release(&bsum.lock);
+    }
+  }
+  if(b == 0 && (b = balloc(ip->dev, goal, sb.size)) == 0 &&
+     (b = balloc(ip->dev, 0, goal)) == 0){
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+
+  acquire(&itable.lock);
+  if(b >= ip->resv && b < ip->resv + ip->resvn){
+    ip->resvn -= b + 1 - ip->resv;
+    ip->resv = b + 1;
+  } else {
+    ip->resv = b + 1;
+    ip->resvn = 0;
+  }
+  release(&itable.lock);
+  return b;
+}
+
+// The block number in *ap, allocating a block if it is zero.
+// bp is the indirect block holding *ap, or 0 for ip->addrs.
+static uint
+getblk(struct inode *ip, struct buf *bp, uint *ap)
+{
+  if(*ap == 0){
+    *ap = iballoc(ip);
+    if(*ap && bp)
+      log_write(bp);
+  }
+  return *ap;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -382,42 +685,66 @@ iunlockput(struct inode *ip)
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, fbn, i, *a;
   struct buf *bp;
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[bn] = addr;
-    }
+  if(bn < NDIRECT)
+    return getblk(ip, 0, &ip->addrs[bn]);
+
+  if(bn - ip->mapbn < ip->mapn && (addr = ip->map[bn - ip->mapbn]) != 0)
     return addr;
-  }
-  bn -= NDIRECT;
 
+  // Find the indirect block listing bn, allocating if necessary.
+  fbn = bn;
+  bn -= NDIRECT;
   if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
+    addr = getblk(ip, 0, &ip->addrs[NDIRECT]);
+  } else {
+    bn -= NINDIRECT;
+    if(bn >= NDINDIRECT)
+      panic("bmap: out of range");
+    if((addr = getblk(ip, 0, &ip->addrs[NDIRECT+1])) == 0)
+      return 0;
     bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
-      }
-    }
+    addr = getblk(ip, bp, (uint*)bp->data + bn / NINDIRECT);
     brelse(bp);
-    return addr;
+    bn %= NINDIRECT;
   }
+  if(addr == 0)
+    return 0;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  addr = getblk(ip, bp, &a[bn]);
+  i = bn - bn % NMAP;
+  memmove(ip->map, a + i, sizeof(ip->map));
+  ip->mapbn = fbn - (bn - i);
+  ip->mapn = NMAP;
+  brelse(bp);
+  return addr;
+}
+
+// Free indirect block addr and the blocks it lists,
+// descending depth more levels of indirect blocks.
+static void
+ifree(struct inode *ip, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
 
-  panic("bmap: out of range");
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 0)
+      ifree(ip, a[j], depth - 1);
+    else
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -425,9 +752,7 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -436,17 +761,16 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = NDIRECT; i < NDIRECT+2; i++){
+    if(ip->addrs[i]){
+      ifree(ip, ip->addrs[i], i - NDIRECT);
+      ip->addrs[i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  ip->mapn = 0;
+  acquire(&itable.lock);
+  ip->resvn = 0;
+  release(&itable.lock);
 
   ip->size = 0;
   iupdate(ip);
@@ -464,6 +788,21 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Read file blocks bn.. up to end that are contiguous on disk
+// with bn, at addr, into the cache with one disk request.
+static void
+readahead(struct inode *ip, uint bn, uint addr, uint end)
+{
+  uint k;
+
+  for(k = 1; k < MAXIOBLOCKS && bn + k < end; k++)
+    if(bmap(ip, bn + k) != addr + k)
+      break;
+  ip->rabn = bn + k;
+  if(k > 1)
+    breadahead(ip->dev, addr, k);
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -471,7 +810,7 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, end;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -479,10 +818,15 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  // read ahead to the end of the file if reading sequentially,
+  // else just what was asked for
+  end = off == ip->rdoff ? ip->size : off + n;
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
+    if(off/BSIZE >= ip->rabn || off/BSIZE + MAXIOBLOCKS < ip->rabn)
+      readahead(ip, off/BSIZE, addr, (end + BSIZE - 1) / BSIZE);
     bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
@@ -492,6 +836,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     }
     brelse(bp);
   }
+  ip->rdoff = off;
   return tot;
 }
 
@@ -510,7 +855,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if((uint64)off + n > (uint64)MAXFILE*BSIZE)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
@@ -546,6 +891,384 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory entry cache.
+//
+// dcache remembers what dirlookup() found: (dev, directory inum,
+// name) -> inum and offset of the entry, or inum 0 if the name is
+// not in the directory. A lookup that hits does not read the
+// directory. dirlink() and unlink (through dirforget()) keep it
+// up to date, and freeing a directory drops its entries. The
+// directory's lock serializes changes to its entries; dcache.lock
+// protects the table itself.
+
+#define NDENTRY 128
+#define NDHASH  64
+
+struct dentry {
+  uint dev;
+  uint dir;               // inum of the directory, 0 if unused
+  char name[DIRSIZ];
+  uint inum;              // 0: name is not in the directory
+  uint off;               // byte offset of the entry
+  struct dentry *hnext;   // hash chain
+  struct dentry *prev;    // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry *hash[NDHASH];
+  struct dentry head;     // head.next is most recent, head.prev is least
+  struct dentry dentry[NDENTRY];
+} dcache;
+
+static uint
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+// Take d off the LRU list and out of the hash table.
+// Caller must hold dcache.lock.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  if(d->dir != 0){
+    for(pp = &dcache.hash[dhash(d->dev, d->dir, d->name)]; *pp != d; pp = &(*pp)->hnext)
+      ;
+    *pp = d->hnext;
+    d->dir = 0;
+  }
+}
+
+// Put d at the front of the LRU list.
+// Caller must hold dcache.lock.
+static void
+dfront(struct dentry *d)
+{
+  d->next = dcache.head.next;
+  d->prev = &dcache.head;
+  dcache.head.next->prev = d;
+  dcache.head.next = d;
+}
+
+// Make d unused and first to be recycled.
+// Caller must hold dcache.lock.
+static void
+dfree(struct dentry *d)
+{
+  dunhash(d);
+  d->next = &dcache.head;
+  d->prev = dcache.head.prev;
+  dcache.head.prev->next = d;
+  dcache.head.prev = d;
+}
+
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dhash(dp->dev, dp->inum, name)]; d != 0; d = d->hnext)
+    if(d->dev == dp->dev && d->dir == dp->inum && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++)
+    dfront(d);
+}
+
+// Remember that name in dp is inum at offset off (inum 0: absent).
+static void
+dcacheput(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+  uint h;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp, name)) == 0){
+    d = dcache.head.prev;   // recycle the least recently used
+    dunhash(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    h = dhash(d->dev, d->dir, d->name);
+    d->hnext = dcache.hash[h];
+    dcache.hash[h] = d;
+    dfront(d);
+  }
+  d->inum = inum;
+  d->off = off;
+  release(&dcache.lock);
+}
+
+// Forget what is known about name in dp.
+// Caller must hold dp->lock.
+void
+dirforget(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp, name)) != 0){
+    dfree(d);
+  }
+  release(&dcache.lock);
+}
+
+// Forget every entry of directory inum, which is being freed.
+static void
+dirpurge(uint dev, uint inum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    if(d->dev == dev && d->dir == inum){
+      dfree(d);
+    }
+  }
+  release(&dcache.lock);
+}
+
+// Hashed directories.
+//
+// A directory starts out as a plain array of dirents. When its
+// first block is full, dirlink() moves the entries other than
+// "." and ".." to a leaf block and puts an index with that one
+// leaf in block 0. A full leaf is split in two by hash, which
+// writes three blocks and the inode, so a lookup or an insert
+// reads two blocks however big the directory grows. Entries
+// keep their place until a split moves them; unlink just clears
+// them. Older directories already bigger than a block stay plain.
+
+#define LEAFHASH(x, i)  ((x)[(i) / NIDX].hash[(i) % NIDX])
+#define LEAFBN(x, i)    ((x)[(i) / NIDX].bn[(i) % NIDX])
+
+// FNV-1a; mkfs has a copy.
+static uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// The leaf in index x whose hashes include h.
+static int
+findleaf(struct dirindex *x, uint h)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = x[0].n - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(LEAFHASH(x, mid) <= h)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+// Look for name in hashed directory dp. If found, set *poff
+// and return its inum, else return 0.
+static uint
+hlookup(struct inode *dp, char *name, uint *poff)
+{
+  struct buf *bp;
+  struct dirent *de;
+  struct dirindex *x;
+  uint bn, i, inum;
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < 2; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      *poff = i * sizeof(*de);
+      inum = de[i].inum;
+      brelse(bp);
+      return inum;
+    }
+  }
+  x = (struct dirindex*)bp->data + 2;
+  bn = LEAFBN(x, findleaf(x, dirhash(name)));
+  brelse(bp);
+
+  bp = bread(dp->dev, bmap(dp, bn));
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < DPB; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      *poff = bn * BSIZE + i * sizeof(*de);
+      inum = de[i].inum;
+      brelse(bp);
+      return inum;
+    }
+  }
+  brelse(bp);
+  return 0;
+}
+
+// Turn dp, a plain directory of one full block, into a hashed one.
+static int
+hconvert(struct inode *dp)
+{
+  struct buf *bp, *lp;
+  struct dirindex *x;
+  uint addr;
+
+  if((addr = bmap(dp, 1)) == 0)
+    return -1;
+  bp = bread(dp->dev, bmap(dp, 0));
+  lp = bread(dp->dev, addr);
+  memmove(lp->data + 2*sizeof(struct dirent), bp->data + 2*sizeof(struct dirent),
+          BSIZE - 2*sizeof(struct dirent));
+  log_write(lp);
+  brelse(lp);
+
+  memset(bp->data + 2*sizeof(struct dirent), 0, BSIZE - 2*sizeof(struct dirent));
+  x = (struct dirindex*)bp->data + 2;
+  x[0].n = 1;
+  LEAFHASH(x, 0) = 0;
+  LEAFBN(x, 0) = 1;
+  log_write(bp);
+  brelse(bp);
+
+  dp->major = DIRHASHED;
+  dp->size = 2 * BSIZE;
+  iupdate(dp);
+  dirpurge(dp->dev, dp->inum);   // the offsets changed
+  return 0;
+}
+
+// Split full leaf li of hashed directory dp, whose index block
+// is ip and leaf block lp, moving the upper half of its hashes
+// to a new leaf at the end of the directory.
+static int
+hsplit(struct inode *dp, struct buf *ip, int li, struct buf *lp)
+{
+  struct dirindex *x;
+  struct dirent *de, *ne;
+  struct buf *np;
+  uint s[DPB], m, t, nb, addr;
+  int i, j;
+
+  x = (struct dirindex*)ip->data + 2;
+  if(x[0].n == NLEAF)
+    return -1;
+
+  // the median hash, or the next bigger one if half are the lowest
+  de = (struct dirent*)lp->data;
+  for(i = 0; i < DPB; i++){
+    s[i] = dirhash(de[i].name);
+    for(j = i; j > 0 && s[j-1] > s[j]; j--){
+      t = s[j];
+      s[j] = s[j-1];
+      s[j-1] = t;
+    }
+  }
+  for(i = DPB/2; i < DPB && s[i] == s[0]; i++)
+    ;
+  if(i == DPB)
+    return -1;   // all the same hash
+  m = s[i];
+
+  nb = dp->size / BSIZE;
+  if((addr = bmap(dp, nb)) == 0)
+    return -1;
+  np = bread(dp->dev, addr);
+  ne = (struct dirent*)np->data;
+  for(i = j = 0; i < DPB; i++){
+    if(dirhash(de[i].name) >= m){
+      ne[j++] = de[i];
+      memset(&de[i], 0, sizeof(de[i]));
+    }
+  }
+  log_write(np);
+  brelse(np);
+  log_write(lp);
+
+  for(i = x[0].n; i > li + 1; i--){
+    LEAFHASH(x, i) = LEAFHASH(x, i-1);
+    LEAFBN(x, i) = LEAFBN(x, i-1);
+  }
+  LEAFHASH(x, li+1) = m;
+  LEAFBN(x, li+1) = nb;
+  x[0].n++;
+  log_write(ip);
+
+  dp->size += BSIZE;
+  iupdate(dp);
+  dirpurge(dp->dev, dp->inum);   // the offsets changed
+  return 0;
+}
+
+// Add (name, inum) to hashed directory dp.
+// Returns the entry's offset, or -1.
+static int
+hlink(struct inode *dp, char *name, uint inum)
+{
+  struct buf *ip, *lp;
+  struct dirent *de;
+  struct dirindex *x;
+  uint h, bn, i;
+  int li;
+
+  h = dirhash(name);
+  for(;;){
+    ip = bread(dp->dev, bmap(dp, 0));
+    x = (struct dirindex*)ip->data + 2;
+    li = findleaf(x, h);
+    bn = LEAFBN(x, li);
+    lp = bread(dp->dev, bmap(dp, bn));
+    de = (struct dirent*)lp->data;
+    for(i = 0; i < DPB; i++){
+      if(de[i].inum == 0){
+        strncpy(de[i].name, name, DIRSIZ);
+        de[i].inum = inum;
+        log_write(lp);
+        brelse(lp);
+        brelse(ip);
+        return bn * BSIZE + i * sizeof(*de);
+      }
+    }
+    if(hsplit(dp, ip, li, lp) < 0){
+      brelse(lp);
+      brelse(ip);
+      return -1;
+    }
+    brelse(lp);
+    brelse(ip);
+  }
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -553,10 +1276,39 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
   struct dirent de;
+  struct dentry *d;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  acquire(&dcache.lock);
+  if((d = dfind(dp, name)) != 0){
+    inum = d->inum;
+    off = d->off;
+    // most recently used
+    d->next->prev = d->prev;
+    d->prev->next = d->next;
+    dfront(d);
+    release(&dcache.lock);
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+  release(&dcache.lock);
+
+  if(dp->major == DIRHASHED){
+    if((inum = hlookup(dp, name, &off)) == 0){
+      dcacheput(dp, name, 0, 0);
+      return 0;
+    }
+    if(poff)
+      *poff = off;
+    dcacheput(dp, name, inum, off);
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -567,10 +1319,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcacheput(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcacheput(dp, name, 0, 0);
   return 0;
 }
 
@@ -589,18 +1343,32 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if(dp->major != DIRHASHED){
+    // Look for an empty dirent.
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink read");
+      if(de.inum == 0)
+        break;
+    }
+    // a full first block: switch to hashing
+    if(off == BSIZE && dp->size == BSIZE && hconvert(dp) < 0)
+      return -1;
   }
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+  if(dp->major == DIRHASHED){
+    off = hlink(dp, name, inum);
+  } else {
+    strncpy(de.name, name, DIRSIZ);
+    de.inum = inum;
+    if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      off = -1;
+  }
+  if(off < 0){
+    dirforget(dp, name);
     return -1;
+  }
+  dcacheput(dp, name, inum, off);
 
   return 0;
 }
@@ -3,7 +3,9 @@
 
 
 #define ROOTINO  1   // root i-number
-#define BSIZE 1024  // block size
+#ifndef BSIZE
+#define BSIZE 1024  // block size; make BSIZE=4096 for 4 KB blocks
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -20,13 +22,23 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size (bytes), must be BSIZE
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+// The format is not the one of older xv6 images: NDIRECT and the
+// double-indirect block change struct dinode, directory entries
+// hold 30-character names, the log header is checksummed, and
+// the superblock has bsize. Older images have
+// bsize 0 there and fsinit() refuses them; rebuild them with mkfs.
+// Within this format the log size is taken from nlog, so mkfs may
+// pick any size up to LOGSIZE.
+
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +47,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -51,10 +63,30 @@ struct dinode {
 #define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
 
 // Directory is a file containing a sequence of dirent structures.
-#define DIRSIZ 14
+#define DIRSIZ 30
 
 struct dirent {
   ushort inum;
   char name[DIRSIZ];
 };
 
+// Dirents per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A directory bigger than a block is hashed if its dinode's
+// major is DIRHASHED. Its block 0 holds "." and "..", then an
+// index of leaf blocks in records shaped like free dirents, so
+// programs that read dirents skip them. Leaf i holds the names
+// whose dirhash() is at least hash[i] and below hash[i+1].
+#define DIRHASHED 1
+#define NIDX      3
+#define NLEAF     ((DPB - 2) * NIDX)  // max leaves in a directory
+
+struct dirindex {
+  ushort zero;          // 0, like a free dirent's inum
+  ushort n;             // first record only: number of leaves
+  uint hash[NIDX];
+  uint bn[NIDX];        // file block number of the leaf
+  uint pad;
+};
+
@@ -17,34 +17,63 @@
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// the count of in-progress FS system calls, reserves
+// MAXOPBLOCKS of log space and returns. But if the
+// reservations would not fit in the log, it sleeps until
+// the last outstanding end_op() commits. An operation that
+// knows it writes more, like a big write(), calls
+// begin_opn()/end_opn() to reserve more.
+//
+// mkfs chooses the size of the log and records it in
+// the superblock; the kernel uses up to LOGSIZE blocks,
+// which is what one descriptor block can describe.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+//   head block, containing the sequence number of the
+//     first transaction in the log
+//   descriptor of transaction seq: block #s for A, B, ...
 //   block A
 //   block B
-//   block C
+//   descriptor of transaction seq+1
 //   ...
-// Log appends are synchronous.
+// A descriptor carries a checksum of itself and its blocks,
+// so a commit writes the descriptor and the blocks together,
+// in one batch of disk requests, and recovery replays
+// transactions up to the first one that is missing or does
+// not match its checksum. A block may be in several
+// transactions; the last copy wins.
+//
+// Committed transactions stay in the log until it is half
+// full. Then install_trans() writes each block home once,
+// from the cache where it is pinned, in block order and
+// with all the disk requests outstanding at once.
+
+#define LOGMAGIC 0x4c4f4721   // "!GOL"
 
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+// A transaction descriptor; the head block uses magic and seq.
 struct logheader {
-  int n;
-  int block[LOGSIZE];
+  uint magic;
+  uint seq;
+  uint sum;     // of the descriptor, with sum 0, and the blocks
+  uint n;
+  uint block[LOGSIZE];
 };
 
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // blocks in the log after the head
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // blocks reserved by the outstanding calls.
   int committing;  // in commit(), please wait.
   int dev;
-  struct logheader lh;
+  uint seq;        // sequence number of the next transaction.
+  int n;           // blocks logged since the last install.
+  int committed;   // block[0..committed) are on disk,
+  int ntrans;      // in this many transactions.
+  uint block[LOGSIZE];
+  struct buf *bufs[LOGSIZE+1];  // for write_log() and install_trans()
 };
 struct log log;
 
@@ -54,71 +83,130 @@ static void commit();
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
-  log.size = sb->nlog;
+  log.size = sb->nlog - 1;   // the head takes a block, see fs.h
+  if(log.size > LOGSIZE)
+    log.size = LOGSIZE;
+  if(log.size < 2*MAXOPBLOCKS + 2)
+    panic("initlog: log too small");
   log.dev = dev;
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
-static void
-install_trans(int recovering)
+// FNV-1a, a word at a time, over a block.
+static uint
+logsum(uint sum, uchar *data)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
-  }
+  uint *w = (uint*)data;
+  int i;
+
+  for (i = 0; i < BSIZE/4; i++)
+    sum = (sum ^ w[i]) * 16777619;
+  return sum;
 }
 
-// Read the log header from disk into the in-memory log header
-static void
-read_head(void)
+// Checksum the descriptor in bufs[0] and its n blocks.
+static uint
+transsum(struct buf **bufs, int n)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
+  struct logheader *d = (struct logheader *) bufs[0]->data;
+  uint sum, save;
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+
+  save = d->sum;
+  d->sum = 0;
+  sum = logsum(2166136261, bufs[0]->data);
+  d->sum = save;
+  for (i = 1; i <= n; i++)
+    sum = logsum(sum, bufs[i]->data);
+  return sum;
+}
+
+// Write the committed blocks to their home locations.
+// The cache has the last copy of each; write those home
+// in block order. Sorting log.block is fine, the log is
+// cleared next.
+static void
+install_trans(void)
+{
+  int tail, i, n;
+  uint b;
+
+  for (tail = 1; tail < log.n; tail++) {
+    b = log.block[tail];
+    for (i = tail; i > 0 && log.block[i-1] > b; i--)
+      log.block[i] = log.block[i-1];
+    log.block[i] = b;
+  }
+  n = 0;
+  for (tail = 0; tail < log.n; tail++)
+    if (n == 0 || log.block[tail] != log.bufs[n-1]->blockno)
+      log.bufs[n++] = bread(log.dev, log.block[tail]); // cached
+  bwritev(log.bufs, n, 0);
+  for (i = 0; i < n; i++) {
+    bunpin(log.bufs[i]);
+    brelse(log.bufs[i]);
   }
-  brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write the head block: the log is empty, and
+// its first transaction will be log.seq.
 static void
 write_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bnew(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
-  }
+
+  memset(hb, 0, BSIZE);
+  hb->magic = LOGMAGIC;
+  hb->seq = log.seq;
   bwrite(buf);
   brelse(buf);
 }
 
+// Replay the committed transactions, in order, up to the
+// first one that is missing or does not match its checksum.
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
+  struct buf *buf, *dbuf;
+  struct logheader *d;
+  int p, i, n, ok;
+
+  buf = bread(log.dev, log.start);
+  d = (struct logheader *) (buf->data);
+  log.seq = d->magic == LOGMAGIC ? d->seq : 1;
+  brelse(buf);
+
+  for (p = 0; p < log.size; p += 1+n) {
+    log.bufs[0] = bread(log.dev, log.start+1+p);
+    d = (struct logheader *) (log.bufs[0]->data);
+    if (d->magic != LOGMAGIC || d->seq != log.seq || d->n > log.size-p-1) {
+      brelse(log.bufs[0]);
+      break;
+    }
+    n = d->n;
+    for (i = 1; i <= n; i++)
+      log.bufs[i] = bread(log.dev, log.start+1+p+i);
+    ok = transsum(log.bufs, n) == d->sum;
+    if (ok) {
+      for (i = 1; i <= n; i++) {
+        dbuf = bread(log.dev, d->block[i-1]);
+        memmove(dbuf->data, log.bufs[i]->data, BSIZE);  // copy block to dst
+        bwrite(dbuf);  // write dst to disk
+        brelse(dbuf);
+      }
+      log.seq++;
+    }
+    for (i = 0; i <= n; i++)
+      brelse(log.bufs[i]);
+    if (!ok)
+      break;  // torn: the commit never finished
+  }
   write_head(); // clear the log
 }
 
@@ -126,30 +214,51 @@ recover_from_log(void)
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+// Start an FS operation that writes at most n blocks.
+// Asks for about half the log or more get a bit less, so
+// two big operations can share a transaction. Returns the
+// number of blocks reserved, which must be passed to end_opn().
+int
+begin_opn(int n)
+{
+  if(n > log.size/2 - 1)
+    n = log.size/2 - 1;
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.n + log.ntrans + 1 + log.reserved + n > log.size){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
   }
+  return n;
 }
 
 // called at the end of each FS system call.
 // commits if this was the last outstanding operation.
 void
 end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+void
+end_opn(int n)
 {
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= n;
   if(log.committing)
     panic("log.committing");
   if(log.outstanding == 0){
@@ -174,31 +283,50 @@ end_op(void)
   }
 }
 
-// Copy modified blocks from cache to log.
+// Write the committing transaction: a descriptor, then the
+// blocks straight from the cache, consecutive on disk, so
+// this is a few big requests started together and no copying.
+// When they are done, the transaction has committed.
 static void
 write_log(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  struct logheader *d;
+  int i, n;
+
+  n = log.n - log.committed;
+  log.bufs[0] = bnew(log.dev, log.start+1+log.committed+log.ntrans);
+  d = (struct logheader *) (log.bufs[0]->data);
+  memset(d, 0, BSIZE);
+  d->magic = LOGMAGIC;
+  d->seq = log.seq;
+  d->n = n;
+  for (i = 0; i < n; i++) {
+    d->block[i] = log.block[log.committed+i];
+    log.bufs[i+1] = bread(log.dev, d->block[i]); // cached
   }
+  d->sum = transsum(log.bufs, n);
+  bwritev(log.bufs, n+1, log.bufs[0]->blockno);
+  for (i = 0; i <= n; i++)
+    brelse(log.bufs[i]);
 }
 
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  if (log.n > log.committed) {
+    write_log();     // Write descriptor and blocks -- the real commit
+    log.committed = log.n;
+    log.ntrans++;
+    log.seq++;
+  }
+  if (log.n + log.ntrans > log.size/2) {
+    // install only when the log is half full, so that begin_opn()
+    // always finds room for half the log after a commit.
+    install_trans(); // Now install writes to home locations
+    log.n = 0;
+    log.committed = 0;
+    log.ntrans = 0;
+    write_head();    // Erase the transactions from the log
   }
 }
 
@@ -217,19 +345,21 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
+  for (i = log.n-1; i >= 0; i--) {
+    if (log.block[i] == b->blockno)
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
-    bpin(b);
-    log.lh.n++;
+  if (i < log.committed) {  // not already in this transaction?
+    // a block that an earlier transaction logged gets a new
+    // slot, but it is still pinned only once.
+    if (log.n + log.ntrans + 1 >= log.size)
+      panic("too big a transaction");
+    if (i < 0)
+      bpin(b);
+    log.block[log.n++] = b->blockno;
   }
   release(&log.lock);
 }
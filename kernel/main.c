@@ -26,8 +26,12 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
+    dcacheinit();    // directory entry cache
     fileinit();      // file table
     virtio_disk_init(); // emulated hard disk
+#ifdef MEMBENCH
+    membench();      // mem* bytes/cycle
+#endif
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
@@ -2,12 +2,13 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // i-node table entries to start with
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define LOGSIZE      (BSIZE/4-4)  // max data blocks in on-disk log
+#define NBUF         (LOGSIZE+MAXOPBLOCKS*3)  // size of disk block cache
+#define MAXIOBLOCKS  8    // max blocks in one disk request
+#define FSSIZE       (20000*1024/BSIZE) // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
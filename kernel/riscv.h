@@ -265,6 +265,15 @@ r_time()
   return x;
 }
 
+// cycle counter, readable once mcounteren.CY is set
+static inline uint64
+r_cycle()
+{
+  uint64 x;
+  asm volatile("csrr %0, cycle" : "=r" (x) );
+  return x;
+}
+
 // enable device interrupts
 static inline void
 intr_on()
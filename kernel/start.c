@@ -43,6 +43,9 @@ start()
   w_pmpaddr0(0x3fffffffffffffull);
   w_pmpcfg0(0xf);
 
+  // let supervisor mode read the cycle and time counters.
+  w_mcounteren(r_mcounteren() | 0x3);
+
   // ask for clock interrupts.
   timerinit();
 
@@ -1,13 +1,26 @@
 #include "types.h"
 
+// The mem* functions move 8 bytes at a time once the pointers are
+// aligned; head and tail are done a byte at a time.
+typedef uint64 __attribute__((__may_alias__)) word;
+
+#define ALIGNED(p) (((uint64)(p) & 7) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w;
+
+  while(n > 0 && !ALIGNED(cdst)){
+    *cdst++ = c;
+    n--;
   }
+  w = 0x0101010101010101UL * (uchar)c;
+  for(; n >= 8; n -= 8, cdst += 8)
+    *(word*)cdst = w;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -18,6 +31,16 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if((((uint64)s1 ^ (uint64)s2) & 7) == 0){
+    while(n > 0 && !ALIGNED(s1)){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
+    }
+    // skip equal words; the byte loop finds the difference
+    for(; n >= 8 && *(word*)s1 == *(word*)s2; n -= 8)
+      s1 += 8, s2 += 8;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -41,11 +64,42 @@ memmove(void *dst, const void *src, uint n)
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if((((uint64)s ^ (uint64)d) & 7) == 0){
+      while(n > 0 && !ALIGNED(d)){
+        *--d = *--s;
+        n--;
+      }
+      for(; n >= 8; n -= 8){
+        s -= 8, d -= 8;
+        *(word*)d = *(word*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    while(n > 0 && !ALIGNED(d)){
+      *d++ = *s++;
+      n--;
+    }
+    if(ALIGNED(s)){
+      for(; n >= 8; n -= 8, s += 8, d += 8)
+        *(word*)d = *(word*)s;
+    } else if(n >= 8){
+      // d is aligned but s is not: build each word from two aligned
+      // loads. They never cross a page, and with d < s nothing unread
+      // is overwritten.
+      uint sh = ((uint64)s & 7) * 8;
+      const word *ws = (const word*)((uint64)s & ~7);
+      uint64 lo = *ws++, hi;
+      for(; n >= 8; n -= 8, s += 8, d += 8){
+        hi = *ws++;
+        *(word*)d = (lo >> sh) | (hi << (64 - sh));
+        lo = hi;
+      }
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
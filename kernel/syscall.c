@@ -103,6 +103,7 @@ extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_setviflag(void);
 extern uint64 sys_eraseviflag(void);
+extern uint64 sys_lseek(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -130,6 +131,7 @@ static uint64 (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_setviflag] sys_setviflag,
 [SYS_eraseviflag] sys_eraseviflag,
+[SYS_lseek]   sys_lseek,
 };
 
 void
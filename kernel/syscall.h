@@ -22,3 +22,4 @@
 #define SYS_close  21
 #define SYS_setviflag 22
 #define SYS_eraseviflag 23
+#define SYS_lseek  24
@@ -107,6 +107,19 @@ sys_close(void)
   return 0;
 }
 
+uint64
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  argint(1, &off);
+  argint(2, &whence);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
 uint64
 sys_fstat(void)
 {
@@ -222,6 +235,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dirforget(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -47,7 +47,7 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 32
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -87,8 +87,8 @@ struct virtq_used {
 #define VIRTIO_BLK_T_OUT 1 // write the disk
 
 // the format of the first descriptor in a disk request.
-// to be followed by two more descriptors containing
-// the block, and a one-byte status.
+// to be followed by descriptors containing the blocks,
+// and a one-byte status.
 struct virtio_blk_req {
   uint32 type; // VIRTIO_BLK_T_IN or ..._OUT
   uint32 reserved;
@@ -196,12 +196,12 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
+// a disk transfer of k blocks uses k+2 descriptors.
 static int
-alloc3_desc(int *idx)
+allocn_desc(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,27 +212,34 @@ alloc3_desc(int *idx)
   return 0;
 }
 
+// start a single disk request that reads or writes the n bufs
+// b[0..n-1] from or to blocks blockno..blockno+n-1, and return
+// without waiting for it. virtio_disk_wait(b[0]) waits.
 void
-virtio_disk_rw(struct buf *b, int write)
+virtio_disk_start(struct buf **b, int n, uint blockno, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  uint64 sector = (uint64)blockno * (BSIZE / 512);
+  int i;
+
+  if(n < 1 || n > MAXIOBLOCKS)
+    panic("virtio_disk_start");
 
   acquire(&disk.vdisk_lock);
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // a descriptor for type/reserved/sector, one for each block of
+  // data, and one for a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the descriptors.
+  int idx[MAXIOBLOCKS+2];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(allocn_desc(idx, n+2) == 0) {
       break;
     }
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -249,24 +256,27 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(i = 1; i <= n; i++){
+    disk.desc[idx[i]].addr = (uint64) b[i-1]->data;
+    disk.desc[idx[i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[i]].flags = 0; // device reads b->data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
 
   // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // the first buf stands for the whole request.
+  b[0]->disk = 1;
+  disk.info[idx[0]].b = b[0];
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -280,17 +290,38 @@ virtio_disk_rw(struct buf *b, int write)
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
+  release(&disk.vdisk_lock);
+}
+
+// wait for the request started with b as its first buf.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+
   // Wait for virtio_disk_intr() to say request has finished.
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+// read or write the n bufs b[0..n-1], which hold consecutive
+// blocks, with a single disk request.
+void
+virtio_disk_rwv(struct buf **b, int n, int write)
+{
+  virtio_disk_start(b, n, b[0]->blockno, write);
+  virtio_disk_wait(b[0]);
+}
+
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_rwv(&b, 1, write);
+}
+
 void
 virtio_disk_intr()
 {
@@ -320,6 +351,12 @@ virtio_disk_intr()
     b->disk = 0;   // disk is done with buf
     wakeup(b);
 
+    // free the descriptors here rather than in the waiter,
+    // so that virtio_disk_start() can have many requests
+    // outstanding and still find free descriptors.
+    disk.info[id].b = 0;
+    free_chain(id);
+
     disk.used_idx += 1;
   }
 
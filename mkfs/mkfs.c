@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = 1 + LOGSIZE;  // header and data blocks, see main
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -31,6 +31,8 @@ struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+struct dirent rootents[NINODES+2];
+int nroot;
 
 
 void balloc(int);
@@ -40,6 +42,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void wdir(uint inum, struct dirent *de, int n);
 void die(const char *);
 
 // convert to riscv byte order
@@ -69,10 +72,9 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
+  uint rootino, inum;
   struct dirent de;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -84,11 +86,17 @@ main(int argc, char *argv[])
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert(sizeof(struct dirindex) == sizeof(struct dirent));
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0)
     die(argv[1]);
 
+  // the largest log the kernel uses, but no more than
+  // a sixteenth of the disk
+  if(nlog > FSSIZE/16)
+    nlog = FSSIZE/16;
+
   // 1 fs block = 1 disk sector
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
   nblocks = FSSIZE - nmeta;
@@ -101,6 +109,7 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.bsize = xint(BSIZE);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
          nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
@@ -120,12 +129,12 @@ main(int argc, char *argv[])
   bzero(&de, sizeof(de));
   de.inum = xshort(rootino);
   strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  rootents[nroot++] = de;
 
   bzero(&de, sizeof(de));
   de.inum = xshort(rootino);
   strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  rootents[nroot++] = de;
 
   for(i = 2; i < argc; i++){
     // get rid of "user/"
@@ -152,7 +161,7 @@ main(int argc, char *argv[])
     bzero(&de, sizeof(de));
     de.inum = xshort(inum);
     strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    rootents[nroot++] = de;
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -160,12 +169,7 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  wdir(rootino, rootents, nroot);
 
   balloc(freeblock);
 
@@ -249,6 +253,21 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Block number in entry i of indirect block ib,
+// allocating a block if it is zero.
+uint
+slot(uint ib, uint i)
+{
+  uint indirect[NINDIRECT];
+
+  rsect(ib, (char*)indirect);
+  if(indirect[i] == 0){
+    indirect[i] = xint(freeblock++);
+    wsect(ib, (char*)indirect);
+  }
+  return xint(indirect[i]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -256,7 +275,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -270,16 +288,17 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      x = slot(xint(din.addrs[NDIRECT]), fbn - NDIRECT);
+    } else {
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
       }
-      x = xint(indirect[fbn-NDIRECT]);
+      x = slot(xint(din.addrs[NDIRECT+1]), (fbn - NDIRECT - NINDIRECT) / NINDIRECT);
+      x = slot(x, (fbn - NDIRECT - NINDIRECT) % NINDIRECT);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -293,6 +312,90 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// Must match dirhash() in kernel/fs.c.
+uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+int
+hashcmp(const void *a, const void *b)
+{
+  uint x = dirhash(((struct dirent*)a)->name);
+  uint y = dirhash(((struct dirent*)b)->name);
+
+  return x < y ? -1 : x > y;
+}
+
+// End of the leaf that starts with sorted entry i of n.
+// Names with the same hash share a leaf.
+int
+leafend(struct dirent *de, int i, int n)
+{
+  int end;
+
+  end = min(n, i + DPB*3/4);
+  while(end < n && end > i && dirhash(de[end].name) == dirhash(de[end-1].name))
+    end--;
+  assert(end > i);
+  return end;
+}
+
+// Write the n entries of directory inum, the first two being "."
+// and "..". If they do not fit in one block, lay the directory out
+// hashed, as dirlink() in kernel/fs.c would, with leaves 3/4 full.
+void
+wdir(uint inum, struct dirent *de, int n)
+{
+  char blk[BSIZE];
+  struct dirindex *x;
+  struct dinode din;
+  int i, end, nleaf;
+
+  if(n <= DPB){
+    iappend(inum, de, n * sizeof(*de));
+    rinode(inum, &din);
+    din.size = xint(BSIZE);
+    winode(inum, &din);
+    return;
+  }
+
+  qsort(de + 2, n - 2, sizeof(*de), hashcmp);
+  bzero(blk, sizeof(blk));
+  memmove(blk, de, 2 * sizeof(*de));
+  x = (struct dirindex*)blk + 2;
+  nleaf = 0;
+  for(i = 2; i < n; i = end){
+    end = leafend(de, i, n);
+    assert(nleaf < NLEAF);
+    x[nleaf / NIDX].hash[nleaf % NIDX] = xint(nleaf == 0 ? 0 : dirhash(de[i].name));
+    x[nleaf / NIDX].bn[nleaf % NIDX] = xint(nleaf + 1);
+    nleaf++;
+  }
+  x[0].n = xshort(nleaf);
+  iappend(inum, blk, BSIZE);
+
+  for(i = 2; i < n; i = end){
+    end = leafend(de, i, n);
+    bzero(blk, sizeof(blk));
+    memmove(blk, de + i, (end - i) * sizeof(*de));
+    iappend(inum, blk, BSIZE);
+  }
+
+  rinode(inum, &din);
+  din.major = xshort(DIRHASHED);
+  winode(inum, &din);
+}
+
 void
 die(const char *s)
 {
@@ -1,106 +1,286 @@
-// Simple grep.  Only supports ^ . * $ operators.
+// grep [-cnvl] [-j n] [-e pattern]... [pattern] [file ...]
+// Patterns are regular expressions, see user/re.h.
+//   -c  print only the number of selected lines
+//   -n  prefix each line with its line number
+//   -v  select the lines that do not match
+//   -l  print only the names of files with a selected line
+//   -e  add a pattern; a line is matched if any pattern matches
+//   -j  search with n worker processes; without -n big files are
+//       split at line boundaries, see user/jobs.h
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
+#include "user/re.h"
+#include "user/jobs.h"
 
-char buf[1024];
-int match(char*, char*);
+#define MAXPAT 8
+
+char buf[32768];
+char obuf[4096];
+int olen;
+
+re_t pats[MAXPAT];
+int npat;
+int cflag, nflag, vflag, lflag;
+int multi;  // more than one file: prefix lines with the file name
+
+void
+flush(void)
+{
+  if(olen > 0)
+    write(1, obuf, olen);
+  olen = 0;
+}
+
+void
+put(char *s, int n)
+{
+  int k;
+
+  while(n > 0){
+    k = sizeof(obuf) - olen;
+    if(k > n)
+      k = n;
+    memmove(obuf + olen, s, k);
+    olen += k;
+    s += k;
+    n -= k;
+    if(olen == sizeof(obuf))
+      flush();
+  }
+}
 
 void
-grep(char *pattern, int fd)
+puts(char *s)
 {
-  int n, m;
+  put(s, strlen(s));
+}
+
+void
+putnum(int n)
+{
+  char tmp[16];
+  int i = sizeof(tmp);
+
+  do{
+    tmp[--i] = '0' + n % 10;
+    n /= 10;
+  }while(n > 0);
+  put(tmp + i, sizeof(tmp) - i);
+}
+
+int
+match(char *line)
+{
+  int i, len;
+
+  for(i = 0; i < npat; i++)
+    if(re_matchp(pats[i], line, &len) >= 0)
+      return 1;
+  return 0;
+}
+
+// Handle one line p..q; *q is overwritten with the terminating NUL.
+// Returns 1 if the rest of the file can be skipped (-l).
+int
+line(char *name, int lineno, char *p, char *q, int *count)
+{
+  *q = '\0';
+  if(match(p) == vflag)
+    return 0;
+  (*count)++;
+  if(lflag)
+    return 1;
+  if(cflag)
+    return 0;
+  if(multi){
+    puts(name);
+    put(":", 1);
+  }
+  if(nflag){
+    putnum(lineno);
+    put(":", 1);
+  }
+  put(p, q - p);
+  put("\n", 1);
+  return 0;
+}
+
+void
+report(char *name, int count)
+{
+  if(lflag && count > 0){
+    puts(name);
+    put("\n", 1);
+  } else if(cflag){
+    if(multi){
+      puts(name);
+      put(":", 1);
+    }
+    putnum(count);
+    put("\n", 1);
+  }
+}
+
+// Search fd, or only the lines of job j when running as a worker.
+void
+grep(char *name, int fd, struct job *j)
+{
+  int n, m, lineno, count, done;
   char *p, *q;
 
   m = 0;
-  while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
+  lineno = 0;
+  count = 0;
+  done = 0;
+  while(!done && (n = j ? jobread(j, fd, buf+m, sizeof(buf)-m-1)
+                        : read(fd, buf+m, sizeof(buf)-m-1)) > 0){
     m += n;
-    buf[m] = '\0';
     p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
+    while(!done && (q = memchr(p, '\n', buf+m-p)) != 0){
+      done = line(name, ++lineno, p, q, &count);
       p = q+1;
     }
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
+    m -= p - buf;
+    memmove(buf, p, m);
+    if(m == sizeof(buf)-1){
+      // longer than the buffer: the part read so far counts as a line
+      done = line(name, ++lineno, buf, buf+m, &count);
+      m = 0;
     }
   }
+  if(!done && m > 0)
+    line(name, ++lineno, buf, buf+m, &count);
+
+  if(j && (cflag || lflag)){
+    // the parent adds up the chunks of a file
+    putnum(count);
+    put("\n", 1);
+  } else
+    report(name, count);
+  flush();
 }
 
-int
-main(int argc, char *argv[])
+void
+work(struct job *j)
 {
-  int fd, i;
-  char *pattern;
+  int fd;
 
-  if(argc <= 1){
-    fprintf(2, "usage: grep pattern [file ...]\n");
+  if((fd = jobopen(j)) < 0){
+    fprintf(2, "grep: cannot open %s\n", j->name);
     exit(1);
   }
-  pattern = argv[1];
+  grep(j->name, fd, j);
+  close(fd);
+}
 
-  if(argc <= 2){
-    grep(pattern, 0);
-    exit(0);
-  }
+int total;
 
-  for(i = 2; i < argc; i++){
-    if((fd = open(argv[i], 0)) < 0){
-      printf("grep: cannot open %s\n", argv[i]);
-      exit(1);
+void
+collect(struct job *j, int fd)
+{
+  int n;
+
+  if(cflag || lflag){
+    if(jobnums(fd, &n, 1) == 1)
+      total += n;
+    if(j->last){
+      report(j->name, total);
+      flush();
+      total = 0;
     }
-    grep(pattern, fd);
-    close(fd);
+    return;
   }
-  exit(0);
+  while((n = read(fd, buf, sizeof(buf))) > 0)
+    write(1, buf, n);
 }
 
-// Regexp matcher from Kernighan & Pike,
-// The Practice of Programming, Chapter 9, or
-// https://www.cs.princeton.edu/courses/archive/spr09/cos333/beautiful.html
-
-int matchhere(char*, char*);
-int matchstar(int, char*, char*);
-
-int
-match(char *re, char *text)
+void
+usage(void)
 {
-  if(re[0] == '^')
-    return matchhere(re+1, text);
-  do{  // must look at empty string
-    if(matchhere(re, text))
-      return 1;
-  }while(*text++ != '\0');
-  return 0;
+  fprintf(2, "usage: grep [-cnvl] [-j n] [-e pattern]... [pattern] [file ...]\n");
+  exit(1);
 }
 
-// matchhere: search for re at beginning of text
-int matchhere(char *re, char *text)
+void
+addpattern(char *pattern)
 {
-  if(re[0] == '\0')
-    return 1;
-  if(re[1] == '*')
-    return matchstar(re[0], re+2, text);
-  if(re[0] == '$' && re[1] == '\0')
-    return *text == '\0';
-  if(*text!='\0' && (re[0]=='.' || re[0]==*text))
-    return matchhere(re+1, text+1);
-  return 0;
+  if(npat == MAXPAT){
+    fprintf(2, "grep: too many patterns\n");
+    exit(1);
+  }
+  if((pats[npat++] = re_compile_into(pattern, 0)) == 0){
+    fprintf(2, "grep: bad pattern %s\n", pattern);
+    exit(1);
+  }
 }
 
-// matchstar: search for c*re at beginning of text
-int matchstar(int c, char *re, char *text)
+int
+main(int argc, char *argv[])
 {
-  do{  // a * matches zero or more instances
-    if(matchhere(re, text))
-      return 1;
-  }while(*text!='\0' && (*text++==c || c=='.'));
-  return 0;
-}
+  int fd, i, nworker;
+  char *p;
+
+  nworker = 1;
+  for(i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++){
+    for(p = argv[i]+1; *p; p++){
+      switch(*p){
+      case 'c': cflag = 1; break;
+      case 'n': nflag = 1; break;
+      case 'v': vflag = 1; break;
+      case 'l': lflag = 1; break;
+      case 'j':
+        if(p[1] != '\0')
+          nworker = atoi(p+1);
+        else if(++i < argc)
+          nworker = atoi(argv[i]);
+        else
+          usage();
+        if(nworker < 1 || nworker > MAXWORKERS){
+          fprintf(2, "grep: -j takes 1 to %d\n", MAXWORKERS);
+          exit(1);
+        }
+        goto next;
+      case 'e':
+        if(p[1] != '\0')
+          addpattern(p+1);
+        else if(++i < argc)
+          addpattern(argv[i]);
+        else
+          usage();
+        goto next;  // rest of the argument was the pattern
+      default:
+        usage();
+      }
+    }
+  next:;
+  }
+  if(npat == 0){
+    if(i >= argc)
+      usage();
+    addpattern(argv[i++]);
+  }
 
+  if(i >= argc){
+    grep("(standard input)", 0, 0);
+    exit(0);
+  }
+
+  multi = argc - i > 1;
+  if(nworker > 1){
+    // line numbers need the whole file, so -n splits by file only
+    jobsplit("grep", argv+i, argc-i, nworker, !nflag);
+    jobrun(nworker, work, collect);
+    exit(0);
+  }
+  for(; i < argc; i++){
+    if((fd = open(argv[i], 0)) < 0){
+      printf("grep: cannot open %s\n", argv[i]);
+      exit(1);
+    }
+    grep(argv[i], fd, 0);
+    close(fd);
+  }
+  exit(0);
+}
@@ -0,0 +1,159 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+#include "user/jobs.h"
+
+struct job *jobs;
+int njob;
+
+// Build the job list. With split set, a file of at least 2*CHUNK bytes
+// is cut into up to nworker chunks. Exits if a file cannot be opened.
+int
+jobsplit(char *prog, char **files, int nfile, int nworker, int split)
+{
+  struct stat st;
+  int i, k, n, fd;
+
+  jobs = malloc(sizeof(struct job) * nfile * nworker);
+  njob = 0;
+  for(i = 0; i < nfile; i++){
+    if((fd = open(files[i], O_RDONLY)) < 0){
+      printf("%s: cannot open %s\n", prog, files[i]);
+      exit(1);
+    }
+    if(fstat(fd, &st) < 0)
+      st.size = 0;
+    close(fd);
+    n = 1;
+    if(split && st.size >= 2*CHUNK)
+      n = st.size / CHUNK < nworker ? st.size / CHUNK : nworker;
+    for(k = 0; k < n; k++){
+      jobs[njob].name = files[i];
+      jobs[njob].start = (uint64)st.size * k / n;
+      jobs[njob].end = (uint64)st.size * (k+1) / n;
+      jobs[njob].last = k == n-1;
+      njob++;
+    }
+  }
+  return njob;
+}
+
+// Keep up to nworker children running. A child runs work() with its
+// stdout on a pipe; the parent hands the pipes of finished and running
+// jobs to collect() strictly in job order, so output is not reordered.
+void
+jobrun(int nworker, void (*work)(struct job*), void (*collect)(struct job*, int))
+{
+  int i, k, x, p[2];
+
+  i = 0;
+  for(k = 0; k < njob; k++){
+    for(; i < njob && i < k + nworker; i++){
+      if(pipe(p) < 0){
+        fprintf(2, "jobs: pipe failed\n");
+        exit(1);
+      }
+      switch(fork()){
+      case -1:
+        fprintf(2, "jobs: fork failed\n");
+        exit(1);
+      case 0:
+        close(1);
+        dup(p[1]);
+        close(p[0]);
+        close(p[1]);
+        for(x = k; x < i; x++)
+          close(jobs[x].fd);
+        work(&jobs[i]);
+        exit(0);
+      }
+      close(p[1]);
+      jobs[i].fd = p[0];
+    }
+    collect(&jobs[k], jobs[k].fd);
+    close(jobs[k].fd);
+    wait(0);
+  }
+}
+
+// Worker side: open the job's file positioned at its first line.
+int
+jobopen(struct job *j)
+{
+  char b[128];
+  int fd, n, i;
+
+  if((fd = open(j->name, O_RDONLY)) < 0)
+    return -1;
+  j->pos = j->start;
+  j->done = 0;
+  if(j->start > 0){
+    // the line under start belongs to the previous chunk
+    j->pos = lseek(fd, j->start - 1, SEEK_SET);
+    for(;;){
+      if((n = read(fd, b, sizeof(b))) <= 0){
+        j->done = 1;
+        break;
+      }
+      for(i = 0; i < n && b[i] != '\n'; i++)
+        ;
+      if(i < n){
+        j->pos += i + 1;
+        break;
+      }
+      j->pos += n;
+    }
+    lseek(fd, j->pos, SEEK_SET);
+  }
+  if(j->pos >= j->end)
+    j->done = 1;
+  return fd;
+}
+
+// Worker side: read() that stops after the line crossing the job's end.
+int
+jobread(struct job *j, int fd, char *buf, int n)
+{
+  int m, i;
+
+  if(j->done)
+    return 0;
+  if((m = read(fd, buf, n)) <= 0)
+    return m;
+  if(j->pos + m >= j->end){
+    for(i = j->end - 1 - j->pos > 0 ? j->end - 1 - j->pos : 0; i < m; i++){
+      if(buf[i] == '\n'){
+        m = i + 1;
+        j->done = 1;
+        break;
+      }
+    }
+  }
+  j->pos += m;
+  return m;
+}
+
+// Parent side: parse up to n decimal numbers a worker wrote to fd.
+int
+jobnums(int fd, int *v, int n)
+{
+  char b[64];
+  int i, k, m;
+
+  m = 0;
+  while(m < sizeof(b)-1 && (k = read(fd, b+m, sizeof(b)-1-m)) > 0)
+    m += k;
+  b[m] = '\0';
+  k = 0;
+  for(i = 0; i < m && k < n; ){
+    if(b[i] < '0' || b[i] > '9'){
+      i++;
+      continue;
+    }
+    v[k++] = atoi(b+i);
+    while(i < m && b[i] >= '0' && b[i] <= '9')
+      i++;
+  }
+  return k;
+}
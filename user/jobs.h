@@ -0,0 +1,24 @@
+// Worker pool for grep and wc (-j n).
+// Files are split into jobs; big files into chunks that end at line
+// boundaries. Each job runs in a forked child writing to a pipe, and
+// the parent collects the pipes in argument order.
+
+#define MAXWORKERS 8           // every running job holds a pipe fd
+#define CHUNK      (64*1024)   // smallest piece a file is split into
+
+struct job {
+  char *name;
+  int start, end;   // the job owns the lines that start in [start, end)
+  int last;         // last chunk of its file
+  int fd;           // parent: read end of the worker's pipe
+  int pos, done;    // worker: read position
+};
+
+extern struct job *jobs;
+extern int njob;
+
+int jobsplit(char *prog, char **files, int nfile, int nworker, int split);
+void jobrun(int nworker, void (*work)(struct job*), void (*collect)(struct job*, int));
+int jobopen(struct job *j);
+int jobread(struct job *j, int fd, char *buf, int n);
+int jobnums(int fd, int *v, int n);
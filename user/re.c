@@ -4,6 +4,9 @@
  *
  * http://www.cs.princeton.edu/courses/archive/spr09/cos333/beautiful.html
  *
+ * and by Russ Cox's "Regular Expression Matching Can Be Simple And Fast":
+ * the pattern is compiled to a Thompson NFA, and matching runs that NFA as a
+ * lazily built DFA, so it is linear in the text whatever the pattern.
  *
  *
  * Supports:
@@ -11,11 +14,13 @@
  *   '.'        Dot, matches any character
  *   '^'        Start anchor, matches beginning of string
  *   '$'        End anchor, matches end of string
- *   '*'        Asterisk, match zero or more (greedy)
- *   '+'        Plus, match one or more (greedy)
- *   '?'        Question, match zero or one (non-greedy)
+ *   '*'        Asterisk, match zero or more
+ *   '+'        Plus, match one or more
+ *   '?'        Question, match zero or one
+ *   'a|b'      Alternation, match either side
+ *   '(ab)'     Grouping
  *   '[abc]'    Character class, match if one of {'a', 'b', 'c'}
- *   '[^abc]'   Inverted class, match if NOT one of {'a', 'b', 'c'} -- NOTE: feature is currently broken!
+ *   '[^abc]'   Inverted class, match if NOT one of {'a', 'b', 'c'}
  *   '[a-zA-Z]' Character ranges, the character set of the ranges { a-z | A-Z }
  *   '\s'       Whitespace, \t \f \r \n \v and spaces
  *   '\S'       Non-whitespace
@@ -24,6 +29,8 @@
  *   '\d'       Digits, [0-9]
  *   '\D'       Non-digits
  *
+ * Matches are leftmost-longest: re_matchp returns the first position where a
+ * match starts and the longest match from there.
  *
  */
 
@@ -36,30 +43,107 @@
 
 /* Definitions: */
 
-#define MAX_REGEXP_OBJECTS      30    /* Max number of regex symbols in expression. */
 #define MAX_CHAR_CLASS_LEN      40    /* Max length of character-class buffer in.   */
+#define MAX_ATOMS               32    /* Max number of character sets in expression. */
+#define MAX_POSTFIX             96    /* Max number of atoms and operators.          */
+#define MAX_NFA_STATES          64    /* NFA state sets are kept in one uint64.      */
+#define MAX_GROUP_DEPTH         8     /* Max nesting of '(' ')'.                     */
+#define DFA_STATES              32    /* DFA cache budget, per direction.            */
+#define MAX_LITERAL             16    /* Max length of the required literal prefix.  */
 
 
 enum { UNUSED, DOT, BEGIN, END, QUESTIONMARK, STAR, PLUS, CHAR, CHAR_CLASS, INV_CHAR_CLASS, DIGIT, NOT_DIGIT, ALPHA, NOT_ALPHA, WHITESPACE, NOT_WHITESPACE, WORD_EDGE, /* BRANCH */ };
 
-typedef struct regex_t
+/* A single-character item: only used to build the character sets. */
+typedef struct re_token
 {
-  unsigned char  type;   /* CHAR, STAR, etc.                      */
+  unsigned char  type;   /* CHAR, DIGIT, etc.                     */
   union
   {
     unsigned char  ch;   /*      the character itself             */
     unsigned char* ccl;  /*  OR  a pointer to characters in class */
   } u;
-} regex_t;
+} re_token;
+
+/* Postfix form of the pattern, produced by the parser. */
+enum { P_ATOM, P_BOL, P_EOL, P_EMPTY, P_CAT, P_ALT, P_STAR, P_PLUS, P_QUEST };
+
+/* NFA states. SET consumes a byte of its atom's set, the others are epsilon moves. */
+enum { NFA_SET, NFA_SPLIT, NFA_NOP, NFA_BOL, NFA_EOL, NFA_MATCH };
+
+struct nfa_state
+{
+  unsigned char op;
+  unsigned char atom;
+  short out;
+  short out1;
+};
+
+struct nfa
+{
+  struct nfa_state s[MAX_NFA_STATES];
+  int n;
+  int match;                      /* index of the MATCH state                        */
+  uint64 start[2];                /* closure of the start, [1] at the text beginning */
+  uint64 eolacc;                  /* states that reach MATCH when '$' holds          */
+  uint64 succ[MAX_NFA_STATES];    /* closure after a SET state consumed its byte     */
+  uint64* cmask;                  /* [ncls]: SET states that accept the byte class   */
+};
+
+/* Lazily built DFA: a state is a set of NFA states, transitions are filled in
+   as the text needs them. When DFA_STATES is used up the scan carries on as
+   a plain NFA simulation over the same sets. */
+struct dfa
+{
+  int nstate;
+  int unanchored;                 /* a new match may begin at every position         */
+  uint64 mask[DFA_STATES];
+  short* next;                    /* [DFA_STATES][ncls], -1 until computed           */
+};
+
+/* A compiled pattern owns everything it needs, so any number of them can be
+   alive at once. The forward NFA finds where the match ends, the reverse NFA
+   (the pattern read backwards) finds where the leftmost match starts. */
+struct regex_t
+{
+  int ncls;
+  unsigned char cls[256];         /* bytes no atom tells apart share a class         */
+  int anchored;                   /* matches can only start at the text beginning   */
+  int nlit;                       /* every match starts with lit[0..nlit)            */
+  int rare;                       /* offset of the least common byte in lit          */
+  unsigned char lit[MAX_LITERAL];
+  struct nfa fwd;
+  struct nfa rev;
+  struct dfa fdfa;
+  struct dfa rdfa;
+};
+
+/* Compile-time scratch, kept off the (small) user stack. */
+struct frag
+{
+  int start;
+  int out;                        /* list of dangling outs, see patch()              */
+};
+
+struct re_work
+{
+  const char* p;
+  int depth;
+  int err;
+  int natom;
+  unsigned char atoms[MAX_ATOMS][32];
+  int npost;
+  unsigned char post[MAX_POSTFIX][2];
+  struct frag stack[MAX_POSTFIX];
+  uint64 sigs[256];
+  unsigned char rep[256];         /* a byte of each class                            */
+};
 
 
 
 /* Private function declarations: */
-static int matchpattern(regex_t* pattern, const char* text, int* matchlength);
 static int matchcharclass(char c, const char* str);
-static int matchstar(regex_t p, regex_t* pattern, const char* text, int* matchlength);
-static int matchplus(regex_t p, regex_t* pattern, const char* text, int* matchlength);
-static int matchone(regex_t p, char c);
+static int matchone(re_token p, char c);
 static int matchdigit(char c);
 static int matchalpha(char c);
 static int matchwhitespace(char c);
@@ -68,6 +152,7 @@ static int matchmetachar(char c, const char* str);
 static int matchrange(char c, const char* str);
 static int matchdot(char c);
 static int ismetachar(char c);
+static void parse_alt(struct re_work* w);
 
 
 
@@ -77,217 +162,816 @@ int re_match(const char* pattern, const char* text, int* matchlength)
   return re_matchp(re_compile(pattern), text, matchlength);
 }
 
-int re_matchp(re_t pattern, const char* text, int* matchlength)
+#define BIT(i) ((uint64)1 << (i))
+
+static uint64 nfa_step(struct nfa* n, uint64 m, int k, int unanchored)
 {
-  *matchlength = 0;
-  if (pattern != 0)
+  uint64 r = 0;
+  int i;
+
+  m &= n->cmask[k];
+  for (i = 0; m != 0; i++, m >>= 1)
+  {
+    if (m & 1)
+    {
+      r |= n->succ[i];
+    }
+  }
+  if (unanchored)
+  {
+    r |= n->start[0];
+  }
+  return r;
+}
+
+/* Accepting with the text ending (for the reverse NFA: beginning) here? */
+static int nfa_accept(struct nfa* n, uint64 m, int atend)
+{
+  return atend ? (m & n->eolacc) != 0 : (m & BIT(n->match)) != 0;
+}
+
+/* DFA state for set m, -1 when the cache is full. */
+static int dfa_state(re_t re, struct dfa* d, uint64 m)
+{
+  int i;
+
+  for (i = 0; i < d->nstate; i++)
   {
-    if (pattern[0].type == BEGIN)
+    if (d->mask[i] == m)
     {
-      return ((matchpattern(&pattern[1], text, matchlength)) ? 0 : -1);
+      return i;
+    }
+  }
+  if (d->nstate == DFA_STATES)
+  {
+    return -1;
+  }
+  if (d->next == 0)
+  {
+    d->next = malloc(DFA_STATES * re->ncls * sizeof(short));
+  }
+  for (i = 0; i < re->ncls; i++)
+  {
+    d->next[d->nstate * re->ncls + i] = -1;
+  }
+  d->mask[d->nstate] = m;
+  return d->nstate++;
+}
+
+static int dfa_next(re_t re, struct dfa* d, struct nfa* n, int si, int k)
+{
+  short* t = &d->next[si * re->ncls + k];
+
+  if (*t < 0)
+  {
+    *t = dfa_state(re, d, nfa_step(n, d->mask[si], k, d->unanchored));
+  }
+  return *t;
+}
+
+/* Scan text backwards with the reverse NFA, down to from: the smallest
+   position at or after from where a match starts, -1 if there is none. */
+static int scan_start(re_t re, const unsigned char* text, int from, int len)
+{
+  struct nfa* n = &re->rev;
+  struct dfa* d = &re->rdfa;
+  uint64 m = n->start[1];
+  int si = dfa_state(re, d, m);
+  int best = -1;
+  int p, k, t;
+
+  if (nfa_accept(n, m, len == 0))
+  {
+    best = len;
+  }
+  for (p = len - 1; p >= from; p--)
+  {
+    k = re->cls[text[p]];
+    if (si >= 0 && (t = dfa_next(re, d, n, si, k)) >= 0)
+    {
+      si = t;
+      m = d->mask[t];
     }
     else
     {
-      int idx = -1;
+      si = -1;
+      m = nfa_step(n, m, k, 1);
+    }
+    if (nfa_accept(n, m, p == 0))
+    {
+      best = p;
+    }
+  }
+  return best;
+}
 
-      do
-      {
-        idx += 1;
+/* Scan forward from s: the longest end of a match starting there, -1 if
+   there is none. The bytes looked at are added to *work. */
+static int scan_end(re_t re, const unsigned char* text, int s, int len, int* work)
+{
+  struct nfa* n = &re->fwd;
+  struct dfa* d = &re->fdfa;
+  uint64 m = n->start[s == 0];
+  int si = dfa_state(re, d, m);
+  int end = -1;
+  int p, k, t;
 
-        if (matchpattern(pattern, text, matchlength))
-        {
-          if (text[0] == '\0')
-            return -1;
+  if (nfa_accept(n, m, s == len))
+  {
+    end = s;
+  }
+  for (p = s; p < len && m != 0; p++)
+  {
+    k = re->cls[text[p]];
+    if (si >= 0 && (t = dfa_next(re, d, n, si, k)) >= 0)
+    {
+      si = t;
+      m = d->mask[t];
+    }
+    else
+    {
+      si = -1;
+      m = nfa_step(n, m, k, 0);
+    }
+    if (nfa_accept(n, m, p + 1 == len))
+    {
+      end = p + 1;
+    }
+  }
+  *work += p - s;
+  return end;
+}
 
-          return idx;
-        }
-      }
-      while (*text++ != '\0');
+/* Next occurrence of the literal prefix at or after pos, -1 if none. The
+   rarest byte of the prefix is searched for first. */
+static int find_literal(re_t re, const unsigned char* text, int pos, int len)
+{
+  const unsigned char* p;
+  int s;
+
+  while (pos + re->nlit <= len)
+  {
+    p = memchr(text + pos + re->rare, re->lit[re->rare], len - pos - re->nlit + 1);
+    if (p == 0)
+    {
+      return -1;
     }
+    s = p - text - re->rare;
+    if (memcmp(text + s, re->lit, re->nlit) == 0)
+    {
+      return s;
+    }
+    pos = s + 1;
   }
   return -1;
 }
 
+/* Leftmost match start at or after from, -1 if there is none. Anchored
+   patterns and patterns with a literal prefix only try the places a match
+   can start at, and fall back to the reverse scan when the tries cost more
+   than a scan. The prefix only holds after the text beginning: there,
+   branches behind a '^' can start a match too, so position 0 is tried on
+   its own. */
+static int match_start(re_t re, const unsigned char* text, int from, int len)
+{
+  int s, work = 0;
+
+  if (re->anchored)
+  {
+    return from == 0 && scan_end(re, text, 0, len, &work) >= 0 ? 0 : -1;
+  }
+  if (re->nlit > 0)
+  {
+    if (from == 0 && re->fwd.start[1] != re->fwd.start[0]
+        && scan_end(re, text, 0, len, &work) >= 0)
+    {
+      return 0;
+    }
+    s = from;
+    while ((s = find_literal(re, text, s, len)) >= 0)
+    {
+      if (scan_end(re, text, s, len, &work) >= 0)
+      {
+        return s;
+      }
+      if (work > len)
+      {
+        return scan_start(re, text, from, len);
+      }
+      s++;
+    }
+    return -1;
+  }
+  return scan_start(re, text, from, len);
+}
+
+int re_matchp(re_t pattern, const char* text, int* matchlength)
+{
+  return re_matchfrom(pattern, text, 0, matchlength);
+}
+
+int re_matchfrom(re_t pattern, const char* text, int from, int* matchlength)
+{
+  int len, s, e, work = 0;
+
+  *matchlength = 0;
+  if (pattern == 0)
+  {
+    return -1;
+  }
+  len = strlen(text);
+  if (from < 0 || from > len)
+  {
+    return -1;
+  }
+  s = match_start(pattern, (const unsigned char*)text, from, len);
+  /* like the old matcher, an empty match at the very end does not count */
+  if (s < 0 || (s == len && len > 0))
+  {
+    return -1;
+  }
+  e = scan_end(pattern, (const unsigned char*)text, s, len, &work);
+  *matchlength = e - s;
+  return s;
+}
+
 re_t re_compile(const char* pattern)
 {
-  /* The sizes of the two static arrays below substantiates the static RAM usage of this module.
-     MAX_REGEXP_OBJECTS is the max number of symbols in the expression.
-     MAX_CHAR_CLASS_LEN determines the size of buffer for chars in all char-classes in the expression. */
-  static regex_t re_compiled[MAX_REGEXP_OBJECTS];
-  static unsigned char ccl_buf[MAX_CHAR_CLASS_LEN];
-  int ccl_bufidx = 1;
+  /* The static object below substantiates the static RAM usage of this module;
+     its DFA tables are allocated on first use. */
+  static struct regex_t re_static;
+
+  return re_compile_into(pattern, &re_static);
+}
+
+static void re_release(re_t re)
+{
+  if (re->fwd.cmask != 0)  free(re->fwd.cmask);
+  if (re->rev.cmask != 0)  free(re->rev.cmask);
+  if (re->fdfa.next != 0)  free(re->fdfa.next);
+  if (re->rdfa.next != 0)  free(re->rdfa.next);
+  memset(re, 0, sizeof(struct regex_t));
+}
+
+void re_free(re_t re)
+{
+  if (re != 0)
+  {
+    re_release(re);
+    free(re);
+  }
+}
+
+
 
-  char c;     /* current char in pattern   */
-  int i = 0;  /* index into pattern        */
-  int j = 0;  /* index into re_compiled    */
+/* Parser: pattern -> postfix, character sets collected in w->atoms. */
 
-  while (pattern[i] != '\0' && (j+1 < MAX_REGEXP_OBJECTS))
+static void emit(struct re_work* w, int op, int arg)
+{
+  if (w->npost == MAX_POSTFIX)
   {
-    c = pattern[i];
+    w->err = 1;
+    return;
+  }
+  w->post[w->npost][0] = op;
+  w->post[w->npost][1] = arg;
+  w->npost++;
+}
 
-    switch (c)
+static void emit_token(struct re_work* w, re_token t)
+{
+  int c;
+
+  if (w->natom == MAX_ATOMS)
+  {
+    w->err = 1;
+    return;
+  }
+  memset(w->atoms[w->natom], 0, 32);
+  for (c = 1; c < 256; c++)
+  {
+    if (matchone(t, (char)c))
     {
-      /* Meta-characters: */
-      case '^': {    re_compiled[j].type = BEGIN;           } break;
-      case '$': {    re_compiled[j].type = END;             } break;
-      case '.': {    re_compiled[j].type = DOT;             } break;
-      case '*': {    re_compiled[j].type = STAR;            } break;
-      case '+': {    re_compiled[j].type = PLUS;            } break;
-      case '?': {    re_compiled[j].type = QUESTIONMARK;    } break;
-/*    case '|': {    re_compiled[j].type = BRANCH;          } break; <-- not working properly */
+      w->atoms[w->natom][c >> 3] |= 1 << (c & 7);
+    }
+  }
+  emit(w, P_ATOM, w->natom++);
+}
+
+static void parse_class(struct re_work* w)
+{
+  unsigned char ccl_buf[MAX_CHAR_CLASS_LEN];
+  int ccl_bufidx = 1;
+  const char* p = w->p;
+  re_token t;
 
-      /* Escaped character-classes (\s \w ...): */
-      case '\\':
+  /* ccl_buf[0] is 0 so that matchcharclass can look at str[-1] */
+  ccl_buf[0] = 0;
+  t.type = CHAR_CLASS;
+  if (*p == '^')
+  {
+    t.type = INV_CHAR_CLASS;
+    p++;
+  }
+  while (*p != ']' && *p != '\0')
+  {
+    if (*p == '\\')
+    {
+      if (p[1] == '\0' || ccl_bufidx >= MAX_CHAR_CLASS_LEN - 2)
       {
-        if (pattern[i+1] != '\0')
-        {
-          /* Skip the escape-char '\\' */
-          i += 1;
-          /* ... and check the next */
-          switch (pattern[i])
-          {
-            /* Meta-character: */
-            case 'd': {    re_compiled[j].type = DIGIT;            } break;
-            case 'D': {    re_compiled[j].type = NOT_DIGIT;        } break;
-            case 'w': {    re_compiled[j].type = ALPHA;            } break;
-            case 'W': {    re_compiled[j].type = NOT_ALPHA;        } break;
-            case 's': {    re_compiled[j].type = WHITESPACE;       } break;
-            case 'S': {    re_compiled[j].type = NOT_WHITESPACE;   } break;
-            case 'b': {    re_compiled[j].type = WORD_EDGE;        } break;
-
-            /* Escaped character, e.g. '.' or '$' */
-            default:
-            {
-              re_compiled[j].type = CHAR;
-              re_compiled[j].u.ch = pattern[i];
-            } break;
-          }
-        }
+        w->err = 1;
+        return;
+      }
+      ccl_buf[ccl_bufidx++] = *p++;
+    }
+    else if (ccl_bufidx >= MAX_CHAR_CLASS_LEN - 1)
+    {
+      w->err = 1;
+      return;
+    }
+    ccl_buf[ccl_bufidx++] = *p++;
+  }
+  if (*p != ']')
+  {
+    /* Missing ] */
+    w->err = 1;
+    return;
+  }
+  ccl_buf[ccl_bufidx] = 0;
+  t.u.ccl = &ccl_buf[1];
+  w->p = p + 1;
+  emit_token(w, t);
+}
+
+static void parse_atom(struct re_work* w)
+{
+  re_token t;
+  char c = *w->p++;
+
+  switch (c)
+  {
+    case '(':
+    {
+      if (++w->depth > MAX_GROUP_DEPTH)
+      {
+        w->err = 1;
+        return;
+      }
+      parse_alt(w);
+      w->depth--;
+      if (*w->p != ')')
+      {
+        w->err = 1;
+        return;
+      }
+      w->p++;
+    } break;
+    case '^': {    emit(w, P_BOL, 0);                    } break;
+    case '$': {    emit(w, P_EOL, 0);                    } break;
+    case '.': {    t.type = DOT;       emit_token(w, t); } break;
+    case '[': {    parse_class(w);                       } break;
+
+    /* nothing to repeat */
+    case '*':
+    case '+':
+    case '?': {    w->err = 1;                           } break;
+
+    /* Escaped character-classes (\s \w ...): */
+    case '\\':
+    {
+      c = *w->p++;
+      switch (c)
+      {
+        case 'd': {    t.type = DIGIT;            } break;
+        case 'D': {    t.type = NOT_DIGIT;        } break;
+        case 'w': {    t.type = ALPHA;            } break;
+        case 'W': {    t.type = NOT_ALPHA;        } break;
+        case 's': {    t.type = WHITESPACE;       } break;
+        case 'S': {    t.type = NOT_WHITESPACE;   } break;
+        case 'b': {    t.type = WORD_EDGE;        } break;
+
         /* '\\' as last char in pattern -> invalid regular expression. */
-/*
-        else
+        case '\0':
         {
-          re_compiled[j].type = CHAR;
-          re_compiled[j].ch = pattern[i];
+          w->err = 1;
+          return;
         }
-*/
-      } break;
 
-      /* Character class: */
-      case '[':
+        /* Escaped character, e.g. '.' or '$' */
+        default:
+        {
+          t.type = CHAR;
+          t.u.ch = c;
+        } break;
+      }
+      emit_token(w, t);
+    } break;
+
+    /* Other characters: */
+    default:
+    {
+      t.type = CHAR;
+      t.u.ch = c;
+      emit_token(w, t);
+    } break;
+  }
+}
+
+static void parse_repeat(struct re_work* w)
+{
+  parse_atom(w);
+  while (!w->err)
+  {
+    switch (*w->p)
+    {
+      case '*': {    emit(w, P_STAR, 0);    } break;
+      case '+': {    emit(w, P_PLUS, 0);    } break;
+      case '?': {    emit(w, P_QUEST, 0);   } break;
+      default:  return;
+    }
+    w->p++;
+  }
+}
+
+static void parse_cat(struct re_work* w)
+{
+  int n = 0;
+
+  while (!w->err && *w->p != '\0' && *w->p != '|' && *w->p != ')')
+  {
+    parse_repeat(w);
+    if (n++ > 0)
+    {
+      emit(w, P_CAT, 0);
+    }
+  }
+  if (n == 0)
+  {
+    emit(w, P_EMPTY, 0);
+  }
+}
+
+static void parse_alt(struct re_work* w)
+{
+  parse_cat(w);
+  while (!w->err && *w->p == '|')
+  {
+    w->p++;
+    parse_cat(w);
+    emit(w, P_ALT, 0);
+  }
+}
+
+
+
+/* NFA construction from the postfix form (Thompson). Dangling outs of a
+   fragment are chained through the out fields themselves: an entry is
+   state*2 (out) or state*2+1 (out1), -1 ends the list. */
+
+static short* outfield(struct nfa* n, int e)
+{
+  return (e & 1) ? &n->s[e >> 1].out1 : &n->s[e >> 1].out;
+}
+
+static void patch(struct nfa* n, int e, int target)
+{
+  short* f;
+
+  while (e != -1)
+  {
+    f = outfield(n, e);
+    e = *f;
+    *f = target;
+  }
+}
+
+static int append(struct nfa* n, int l1, int l2)
+{
+  int e = l1;
+  short* f;
+
+  if (l1 == -1)
+  {
+    return l2;
+  }
+  while (*(f = outfield(n, e)) != -1)
+  {
+    e = *f;
+  }
+  *f = l2;
+  return l1;
+}
+
+static int state(struct nfa* n, struct re_work* w, int op, int atom)
+{
+  if (n->n == MAX_NFA_STATES)
+  {
+    w->err = 1;
+    return 0;
+  }
+  n->s[n->n].op = op;
+  n->s[n->n].atom = atom;
+  n->s[n->n].out = -1;
+  n->s[n->n].out1 = -1;
+  return n->n++;
+}
+
+static uint64 closure(struct nfa* n, uint64 m, int bol, int eol)
+{
+  struct nfa_state* s;
+  uint64 prev;
+  int i;
+
+  do
+  {
+    prev = m;
+    for (i = 0; i < n->n; i++)
+    {
+      if (!(m & BIT(i)))
+      {
+        continue;
+      }
+      s = &n->s[i];
+      switch (s->op)
       {
-        /* Remember where the char-buffer starts. */
-        int buf_begin = ccl_bufidx;
+        case NFA_SPLIT: {  m |= BIT(s->out) | BIT(s->out1);   } break;
+        case NFA_NOP:   {  m |= BIT(s->out);                  } break;
+        case NFA_BOL:   {  if (bol) m |= BIT(s->out);         } break;
+        case NFA_EOL:   {  if (eol) m |= BIT(s->out);         } break;
+      }
+    }
+  }
+  while (m != prev);
+  return m;
+}
+
+/* Build the NFA; reverse builds it for the pattern read backwards. */
+static int build(re_t re, struct nfa* n, struct re_work* w, int reverse)
+{
+  struct frag* stack = w->stack;
+  struct frag e1, e2;
+  int i, k, s, sp = 0;
 
-        /* Look-ahead to determine if negated */
-        if (pattern[i+1] == '^')
+  for (i = 0; i < w->npost && !w->err; i++)
+  {
+    switch (w->post[i][0])
+    {
+      case P_ATOM:
+      {
+        s = state(n, w, NFA_SET, w->post[i][1]);
+        stack[sp].start = s;
+        stack[sp++].out = s * 2;
+      } break;
+      case P_BOL:
+      case P_EOL:
+      {
+        s = state(n, w, (w->post[i][0] == P_BOL) != reverse ? NFA_BOL : NFA_EOL, 0);
+        stack[sp].start = s;
+        stack[sp++].out = s * 2;
+      } break;
+      case P_EMPTY:
+      {
+        s = state(n, w, NFA_NOP, 0);
+        stack[sp].start = s;
+        stack[sp++].out = s * 2;
+      } break;
+      case P_CAT:
+      {
+        e2 = stack[--sp];
+        e1 = stack[--sp];
+        if (reverse)
         {
-          re_compiled[j].type = INV_CHAR_CLASS;
-          i += 1; /* Increment i to avoid including '^' in the char-buffer */
-          if (pattern[i+1] == 0) /* incomplete pattern, missing non-zero char after '^' */
-          {
-            return 0;
-          }
+          patch(n, e2.out, e1.start);
+          stack[sp].start = e2.start;
+          stack[sp++].out = e1.out;
         }
         else
         {
-          re_compiled[j].type = CHAR_CLASS;
+          patch(n, e1.out, e2.start);
+          stack[sp].start = e1.start;
+          stack[sp++].out = e2.out;
         }
-
-        /* Copy characters inside [..] to buffer */
-        while (    (pattern[++i] != ']')
-                && (pattern[i]   != '\0')) /* Missing ] */
+      } break;
+      case P_ALT:
+      {
+        e2 = stack[--sp];
+        e1 = stack[--sp];
+        s = state(n, w, NFA_SPLIT, 0);
+        n->s[s].out = e1.start;
+        n->s[s].out1 = e2.start;
+        stack[sp].start = s;
+        stack[sp++].out = append(n, e1.out, e2.out);
+      } break;
+      case P_STAR:
+      case P_PLUS:
+      case P_QUEST:
+      {
+        e1 = stack[--sp];
+        s = state(n, w, NFA_SPLIT, 0);
+        n->s[s].out = e1.start;
+        if (w->post[i][0] == P_QUEST)
         {
-          if (pattern[i] == '\\')
-          {
-            if (ccl_bufidx >= MAX_CHAR_CLASS_LEN - 1)
-            {
-              //fputs("exceeded internal buffer!\n", stderr);
-              return 0;
-            }
-            if (pattern[i+1] == 0) /* incomplete pattern, missing non-zero char after '\\' */
-            {
-              return 0;
-            }
-            ccl_buf[ccl_bufidx++] = pattern[i++];
-          }
-          else if (ccl_bufidx >= MAX_CHAR_CLASS_LEN)
-          {
-              //fputs("exceeded internal buffer!\n", stderr);
-              return 0;
-          }
-          ccl_buf[ccl_bufidx++] = pattern[i];
+          stack[sp].start = s;
+          stack[sp++].out = append(n, e1.out, s * 2 + 1);
         }
-        if (ccl_bufidx >= MAX_CHAR_CLASS_LEN)
+        else
         {
-            /* Catches cases such as [00000000000000000000000000000000000000][ */
-            //fputs("exceeded internal buffer!\n", stderr);
-            return 0;
+          patch(n, e1.out, s);
+          stack[sp].start = w->post[i][0] == P_STAR ? s : e1.start;
+          stack[sp++].out = s * 2 + 1;
         }
-        /* Null-terminate string end */
-        ccl_buf[ccl_bufidx++] = 0;
-        re_compiled[j].u.ccl = &ccl_buf[buf_begin];
       } break;
+    }
+  }
+  if (w->err || sp != 1)
+  {
+    return 0;
+  }
+  n->match = state(n, w, NFA_MATCH, 0);
+  if (w->err)
+  {
+    return 0;
+  }
+  patch(n, stack[0].out, n->match);
 
-      /* Other characters: */
-      default:
-      {
-        re_compiled[j].type = CHAR;
-        re_compiled[j].u.ch = c;
-      } break;
+  s = stack[0].start;
+  n->start[0] = closure(n, BIT(s), 0, 0);
+  n->start[1] = closure(n, BIT(s), 1, 0);
+  n->eolacc = 0;
+  for (i = 0; i < n->n; i++)
+  {
+    if (closure(n, BIT(i), 0, 1) & BIT(n->match))
+    {
+      n->eolacc |= BIT(i);
     }
-    /* no buffer-out-of-bounds access on invalid patterns - see https://github.com/kokke/tiny-regex-c/commit/1a279e04014b70b0695fba559a7c05d55e6ee90b */
-    if (pattern[i] == 0)
+    if (n->s[i].op == NFA_SET)
     {
-      return 0;
+      n->succ[i] = closure(n, BIT(n->s[i].out), 0, 0);
     }
+  }
+  n->cmask = malloc(re->ncls * sizeof(uint64));
+  for (k = 0; k < re->ncls; k++)
+  {
+    n->cmask[k] = 0;
+    for (i = 0; i < n->n; i++)
+    {
+      if (n->s[i].op == NFA_SET &&
+          (w->atoms[n->s[i].atom][w->rep[k] >> 3] & (1 << (w->rep[k] & 7))))
+      {
+        n->cmask[k] |= BIT(i);
+      }
+    }
+  }
+  return 1;
+}
 
-    i += 1;
-    j += 1;
+/* Split the 256 byte values into classes no atom tells apart. */
+static void byte_classes(re_t re, struct re_work* w)
+{
+  uint64 sig;
+  int a, b, k;
+
+  re->ncls = 0;
+  for (b = 0; b < 256; b++)
+  {
+    sig = 0;
+    for (a = 0; a < w->natom; a++)
+    {
+      if (w->atoms[a][b >> 3] & (1 << (b & 7)))
+      {
+        sig |= BIT(a);
+      }
+    }
+    for (k = 0; k < re->ncls && w->sigs[k] != sig; k++)
+      ;
+    if (k == re->ncls)
+    {
+      w->sigs[k] = sig;
+      w->rep[k] = b;
+      re->ncls++;
+    }
+    re->cls[b] = k;
   }
-  /* 'UNUSED' is a sentinel used to indicate end-of-pattern */
-  re_compiled[j].type = UNUSED;
+}
 
-  return (re_t) re_compiled;
+/* Rough rank of how common a byte is in text, lower is rarer. */
+static int byte_rank(unsigned char c)
+{
+  if (c == ' ')
+    return 255;
+  if (strchr("etaoinshrl", c) != 0)
+    return 200;
+  if (c >= 'a' && c <= 'z')
+    return 150;
+  if (matchdigit(c))
+    return 120;
+  if (c >= 'A' && c <= 'Z')
+    return 100;
+  if (strchr("_,.;()=-*/\t", c) != 0)
+    return 90;
+  return 50;
 }
 
-void re_print(regex_t* pattern)
+/* Find what every match must start with: nothing but the text beginning
+   (anchored), or a chain of single-byte atoms (the literal prefix). */
+static void prefilter(re_t re, struct re_work* w)
 {
-  const char* types[] = { "UNUSED", "DOT", "BEGIN", "END", "QUESTIONMARK", "STAR", "PLUS", "CHAR", "CHAR_CLASS", "INV_CHAR_CLASS", "DIGIT", "NOT_DIGIT", "ALPHA", "NOT_ALPHA", "WHITESPACE", "NOT_WHITESPACE", "BRANCH", "WORD_EDGE" };
+  struct nfa* n = &re->fwd;
+  uint64 sets = 0, eols = 0, m;
+  int i, b, c;
 
-  int i;
-  int j;
-  char c;
-  for (i = 0; i < MAX_REGEXP_OBJECTS; ++i)
+  for (i = 0; i < n->n; i++)
   {
-    if (pattern[i].type == UNUSED)
+    if (n->s[i].op == NFA_SET)  sets |= BIT(i);
+    if (n->s[i].op == NFA_EOL)  eols |= BIT(i);
+  }
+  re->anchored = (n->start[0] & (sets | eols | BIT(n->match))) == 0;
+
+  m = n->start[0];
+  while (re->nlit < MAX_LITERAL && !(m & (eols | BIT(n->match))))
+  {
+    m &= sets;
+    if (m == 0 || (m & (m - 1)) != 0)
     {
       break;
     }
-
-    printf("type: %s", types[pattern[i].type]);
-    if (pattern[i].type == CHAR_CLASS || pattern[i].type == INV_CHAR_CLASS)
+    for (i = 0; !(m & BIT(i)); i++)
+      ;
+    /* the atom must hold exactly one byte */
+    c = -1;
+    for (b = 1; b < 256; b++)
     {
-      printf(" [");
-      for (j = 0; j < MAX_CHAR_CLASS_LEN; ++j)
+      if (w->atoms[n->s[i].atom][b >> 3] & (1 << (b & 7)))
       {
-        c = pattern[i].u.ccl[j];
-        if ((c == '\0') || (c == ']'))
-        {
+        if (c >= 0)
           break;
-        }
-        printf("%c", c);
+        c = b;
       }
-      printf("]");
     }
-    else if (pattern[i].type == CHAR)
+    if (c < 0 || b < 256)
     {
-      printf(" '%c'", pattern[i].u.ch);
+      break;
+    }
+    if (byte_rank(c) < byte_rank(re->lit[re->rare]) || re->nlit == 0)
+    {
+      re->rare = re->nlit;
     }
-    printf("\n");
+    re->lit[re->nlit++] = c;
+    m = n->succ[i];
   }
 }
 
+re_t re_compile_into(const char* pattern, re_t re)
+{
+  struct re_work* w;
+  re_t into = re;
+  int ok;
+
+  if (into == 0)
+  {
+    into = malloc(sizeof(struct regex_t));
+    memset(into, 0, sizeof(struct regex_t));
+  }
+  else
+  {
+    re_release(into);
+  }
+
+  w = malloc(sizeof(struct re_work));
+  memset(w, 0, sizeof(struct re_work));
+  w->p = pattern;
+  parse_alt(w);
+  /* a ')' without '(' stops the parser early */
+  ok = !w->err && *w->p == '\0';
+  if (ok)
+  {
+    byte_classes(into, w);
+    ok = build(into, &into->fwd, w, 0) && build(into, &into->rev, w, 1);
+    into->rdfa.unanchored = 1;
+    if (ok)
+    {
+      prefilter(into, w);
+    }
+  }
+  free(w);
+
+  if (ok)
+  {
+    return into;
+  }
+  if (re == 0)
+  {
+    re_free(into);
+  }
+  else
+  {
+    re_release(into);
+  }
+  return 0;
+}
+
+
+
 int isdigit(char c) {
   return c >= '0' && c <= '9';
 }
@@ -398,7 +1082,7 @@ static int matchcharclass(char c, const char* str)
   return 0;
 }
 
-static int matchone(regex_t p, char c)
+static int matchone(re_token p, char c)
 {
   switch (p.type)
   {
@@ -415,133 +1099,3 @@ static int matchone(regex_t p, char c)
     default:             return  (p.u.ch == c);
   }
 }
-
-static int matchstar(regex_t p, regex_t* pattern, const char* text, int* matchlength)
-{
-  int prelen = *matchlength;
-  const char* prepoint = text;
-  while ((text[0] != '\0') && matchone(p, *text))
-  {
-    text++;
-    (*matchlength)++;
-  }
-  while (text >= prepoint)
-  {
-    if (matchpattern(pattern, text--, matchlength))
-      return 1;
-    (*matchlength)--;
-  }
-
-  *matchlength = prelen;
-  return 0;
-}
-
-static int matchplus(regex_t p, regex_t* pattern, const char* text, int* matchlength)
-{
-  const char* prepoint = text;
-  while ((text[0] != '\0') && matchone(p, *text))
-  {
-    text++;
-    (*matchlength)++;
-  }
-  while (text > prepoint)
-  {
-    if (matchpattern(pattern, text--, matchlength))
-      return 1;
-    (*matchlength)--;
-  }
-
-  return 0;
-}
-
-static int matchquestion(regex_t p, regex_t* pattern, const char* text, int* matchlength)
-{
-  if (p.type == UNUSED)
-    return 1;
-  if (matchpattern(pattern, text, matchlength))
-      return 1;
-  if (*text && matchone(p, *text++))
-  {
-    if (matchpattern(pattern, text, matchlength))
-    {
-      (*matchlength)++;
-      return 1;
-    }
-  }
-  return 0;
-}
-
-
-#if 0
-
-/* Recursive matching */
-static int matchpattern(regex_t* pattern, const char* text, int *matchlength)
-{
-  int pre = *matchlength;
-  if ((pattern[0].type == UNUSED) || (pattern[1].type == QUESTIONMARK))
-  {
-    return matchquestion(pattern[1], &pattern[2], text, matchlength);
-  }
-  else if (pattern[1].type == STAR)
-  {
-    return matchstar(pattern[0], &pattern[2], text, matchlength);
-  }
-  else if (pattern[1].type == PLUS)
-  {
-    return matchplus(pattern[0], &pattern[2], text, matchlength);
-  }
-  else if ((pattern[0].type == END) && pattern[1].type == UNUSED)
-  {
-    return text[0] == '\0';
-  }
-  else if ((text[0] != '\0') && matchone(pattern[0], text[0]))
-  {
-    (*matchlength)++;
-    return matchpattern(&pattern[1], text+1);
-  }
-  else
-  {
-    *matchlength = pre;
-    return 0;
-  }
-}
-
-#else
-
-/* Iterative matching */
-static int matchpattern(regex_t* pattern, const char* text, int* matchlength)
-{
-  int pre = *matchlength;
-  do
-  {
-    if ((pattern[0].type == UNUSED) || (pattern[1].type == QUESTIONMARK))
-    {
-      return matchquestion(pattern[0], &pattern[2], text, matchlength);
-    }
-    else if (pattern[1].type == STAR)
-    {
-      return matchstar(pattern[0], &pattern[2], text, matchlength);
-    }
-    else if (pattern[1].type == PLUS)
-    {
-      return matchplus(pattern[0], &pattern[2], text, matchlength);
-    }
-    else if ((pattern[0].type == END) && pattern[1].type == UNUSED)
-    {
-      return (text[0] == '\0');
-    }
-/*  Branching is not working properly
-    else if (pattern[1].type == BRANCH)
-    {
-      return (matchpattern(pattern, text) || matchpattern(&pattern[2], text));
-    }
-*/
-  (*matchlength)++;
-  }
-  while ((text[0] != '\0') && matchone(*pattern++, *text++));
-
-  *matchlength = pre;
-  return 0;
-}
-
-#endif
\ No newline at end of file
@@ -11,11 +11,13 @@
  *   '.'        Dot, matches any character
  *   '^'        Start anchor, matches beginning of string
  *   '$'        End anchor, matches end of string
- *   '*'        Asterisk, match zero or more (greedy)
- *   '+'        Plus, match one or more (greedy)
- *   '?'        Question, match zero or one (non-greedy)
+ *   '*'        Asterisk, match zero or more
+ *   '+'        Plus, match one or more
+ *   '?'        Question, match zero or one
+ *   'a|b'      Alternation, match either side
+ *   '(ab)'     Grouping
  *   '[abc]'    Character class, match if one of {'a', 'b', 'c'}
- *   '[^abc]'   Inverted class, match if NOT one of {'a', 'b', 'c'} -- NOTE: feature is currently broken!
+ *   '[^abc]'   Inverted class, match if NOT one of {'a', 'b', 'c'}
  *   '[a-zA-Z]' Character ranges, the character set of the ranges { a-z | A-Z }
  *   '\s'       Whitespace, \t \f \r \n \v and spaces
  *   '\S'       Non-whitespace
@@ -46,14 +48,28 @@ extern "C"{
 typedef struct regex_t* re_t;
 
 
-/* Compile regex string pattern to a regex_t-array. */
+/* Compile regex string pattern to a regex_t-array.
+   The result lives in a static object that the next call overwrites. */
 re_t re_compile(const char* pattern);
 
 
-/* Find matches of the compiled pattern inside text. */
+/* Reentrant compile: into an object from an earlier call, or into a new heap
+   object when re is 0. Returns 0 on an invalid pattern (a new object is then
+   freed again). Heap objects are released with re_free. */
+re_t re_compile_into(const char* pattern, re_t re);
+void re_free(re_t re);
+
+
+/* Find matches of the compiled pattern inside text: the leftmost match start,
+   with the longest match from there in *matchlength. Linear in the text. */
 int re_matchp(re_t pattern, const char* text, int* matchlength);
 
 
+/* Like re_matchp, but the match starts at or after text[from]. '^' still
+   means the beginning of text, so from can be the middle of a line. */
+int re_matchfrom(re_t pattern, const char* text, int from, int* matchlength);
+
+
 /* Find matches of the txt pattern inside text (will compile automatically first). */
 int re_match(const char* pattern, const char* text, int* matchlength);
 
@@ -0,0 +1,155 @@
+// strbench: MB/s of the ulib string functions against plain byte
+// loops, for short (32 byte) and page sized (4096 byte) inputs.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define TICKS 5            // length of each run
+#define BATCH (64*1024)    // bytes between looks at the clock
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+char a[4096+16] __attribute__((aligned(8)));
+char b[4096+16] __attribute__((aligned(8)));
+volatile uint64 sink;
+
+uint
+bytestrlen(const char *s)
+{
+  int n;
+
+  for(n = 0; s[n]; n++)
+    ;
+  return n;
+}
+
+char*
+bytestrchr(const char *s, char c)
+{
+  for(; *s; s++)
+    if(*s == c)
+      return (char*)s;
+  return 0;
+}
+
+int
+bytestrcmp(const char *p, const char *q)
+{
+  while(*p && *p == *q)
+    p++, q++;
+  return (uchar)*p - (uchar)*q;
+}
+
+void*
+bytememchr(const void *vs, int c, uint n)
+{
+  const uchar *s = vs;
+
+  for(; n > 0; s++, n--)
+    if(*s == (uchar)c)
+      return (void*)s;
+  return 0;
+}
+
+void*
+bytememrchr(const void *vs, int c, uint n)
+{
+  const uchar *s = (const uchar*)vs + n;
+
+  while(n-- > 0)
+    if(*--s == (uchar)c)
+      return (void*)s;
+  return 0;
+}
+
+void
+bytememset(void *dst, int c, uint n)
+{
+  char *d = dst;
+
+  while(n-- > 0)
+    *d++ = c;
+}
+
+void
+bytememmove(void *dst, const void *src, int n)
+{
+  char *d = dst;
+  const char *s = src;
+
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
+void*
+bytememmem(const void *h, uint hn, const void *nd, uint nn)
+{
+  const char *p = h;
+  uint i;
+
+  for(i = 0; i + nn <= hn; i++)
+    if(memcmp(p + i, nd, nn) == 0)
+      return (void*)(p + i);
+  return 0;
+}
+
+// One benchmark case: run op over n bytes, the byte loop when slow is set.
+void
+op(int which, int slow, int n)
+{
+  switch(which){
+  case 0: sink = slow ? bytestrlen(a) : strlen(a); break;
+  case 1: sink = (uint64)(slow ? bytestrchr(a, 'z') : strchr(a, 'z')); break;
+  case 2: sink = slow ? bytestrcmp(a, b) : strcmp(a, b); break;
+  case 3: sink = (uint64)(slow ? bytememchr(a, 'z', n) : memchr(a, 'z', n)); break;
+  case 4: sink = (uint64)(slow ? bytememrchr(a, 'z', n) : memrchr(a, 'z', n)); break;
+  case 5: if(slow) bytememset(b, 'x', n); else memset(b, 'x', n); break;
+  case 6: if(slow) bytememmove(b, a, n); else memmove(b, a, n); break;
+  case 7: if(slow) bytememmove(b, a+3, n); else memmove(b, a+3, n); break;
+  case 8: sink = (uint64)(slow ? bytememmem(a, n, "needle", 6) : memmem(a, n, "needle", 6)); break;
+  }
+}
+
+char *names[] = {
+  "strlen", "strchr", "strcmp", "memchr", "memrchr",
+  "memset", "memmove", "memmove+3", "memmem",
+};
+
+// MB/s over a run of TICKS ticks; a tick is about 1/10 s
+int
+rate(int which, int slow, int n)
+{
+  int i, t0;
+  uint64 bytes;
+
+  t0 = uptime();
+  while(uptime() == t0)   // start on a tick boundary
+    ;
+  t0++;
+  bytes = 0;
+  while(uptime() - t0 < TICKS){
+    for(i = 0; i < BATCH / n; i++)
+      op(which, slow, n);
+    bytes += BATCH / n * n;
+  }
+  return bytes * 10 / TICKS / (1024*1024);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int sizes[] = { 32, 4096 };
+  int i, j, n;
+
+  printf("MB/s, byte loop -> ulib\n");
+  for(j = 0; j < NELEM(sizes); j++){
+    n = sizes[j];
+    // strings of n-1 'x' with no 'z' or "needle" in them
+    memset(a, 'x', n - 1);
+    a[n - 1] = '\0';
+    memmove(b, a, n);
+    for(i = 0; i < NELEM(names); i++)
+      printf("%s %d: %d -> %d\n", names[i], n, rate(i, 1, n), rate(i, 0, n));
+  }
+  exit(0);
+}
@@ -3,6 +3,17 @@
 #include "kernel/fcntl.h"
 #include "user/user.h"
 
+// The string and memory functions below go a word (8 bytes) at a time
+// once a pointer is aligned. An aligned load never crosses a page, so
+// reading a little past the end of a string in its last word is safe.
+typedef uint64 __attribute__((__may_alias__)) word;
+
+#define ONES  0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+#define ALIGNED(p) (((uint64)(p) & 7) == 0)
+// nonzero iff some byte of v is zero, see "Bit Twiddling Hacks"
+#define HASZERO(v) (((v) - ONES) & ~(v) & HIGHS)
+
 //
 // wrapper so that it's OK if main() does not call exit().
 //
@@ -53,6 +64,16 @@ strncmp(const char *p, const char *q, uint n)
 int
 strcmp(const char *p, const char *q)
 {
+  uint64 v;
+
+  if((((uint64)p ^ (uint64)q) & 7) == 0){
+    for(; !ALIGNED(p); p++, q++)
+      if(*p == 0 || *p != *q)
+        return (uchar)*p - (uchar)*q;
+    // skip equal words without a NUL; the byte loop finishes
+    for(; (v = *(word*)p) == *(word*)q && !HASZERO(v); p += 8, q += 8)
+      ;
+  }
   while(*p && *p == *q)
     p++, q++;
   return (uchar)*p - (uchar)*q;
@@ -61,33 +82,117 @@ strcmp(const char *p, const char *q)
 uint
 strlen(const char *s)
 {
-  int n;
+  const char *p;
 
-  for(n = 0; s[n]; n++)
-    ;
-  return n;
+  for(p = s; !ALIGNED(p); p++)
+    if(*p == 0)
+      return p - s;
+  while(!HASZERO(*(word*)p))
+    p += 8;
+  while(*p)
+    p++;
+  return p - s;
 }
 
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w;
+
+  while(n > 0 && !ALIGNED(cdst)){
+    *cdst++ = c;
+    n--;
   }
+  w = ONES * (uchar)c;
+  for(; n >= 8; n -= 8, cdst += 8)
+    *(word*)cdst = w;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
 char*
 strchr(const char *s, char c)
 {
+  uint64 rep, v;
+
+  for(; !ALIGNED(s); s++){
+    if(*s == 0)
+      return 0;
+    if(*s == c)
+      return (char*)s;
+  }
+  rep = ONES * (uchar)c;
+  for(;; s += 8){
+    v = *(word*)s;
+    if(HASZERO(v) || HASZERO(v ^ rep))
+      break;
+  }
   for(; *s; s++)
     if(*s == c)
       return (char*)s;
   return 0;
 }
 
+void*
+memchr(const void *vs, int c, uint n)
+{
+  const uchar *s = vs;
+  uint64 rep;
+
+  c = (uchar)c;
+  for(; n > 0 && !ALIGNED(s); s++, n--)
+    if(*s == c)
+      return (void*)s;
+  rep = ONES * c;
+  for(; n >= 8 && !HASZERO(*(word*)s ^ rep); s += 8, n -= 8)
+    ;
+  for(; n > 0; s++, n--)
+    if(*s == c)
+      return (void*)s;
+  return 0;
+}
+
+// Last c in s[0..n).
+void*
+memrchr(const void *vs, int c, uint n)
+{
+  const uchar *s = (const uchar*)vs + n;
+  uint64 rep;
+
+  c = (uchar)c;
+  for(; n > 0 && !ALIGNED(s); n--)
+    if(*--s == c)
+      return (void*)s;
+  rep = ONES * c;
+  for(; n >= 8 && !HASZERO(*(word*)(s - 8) ^ rep); s -= 8, n -= 8)
+    ;
+  for(; n > 0; n--)
+    if(*--s == c)
+      return (void*)s;
+  return 0;
+}
+
+// First occurrence of needle[0..nn) in h[0..hn).
+void*
+memmem(const void *h, uint hn, const void *needle, uint nn)
+{
+  const uchar *p = h, *end, *nd = needle;
+
+  if(nn == 0)
+    return (void*)h;
+  if(nn > hn)
+    return 0;
+  end = p + hn - nn + 1;   // last possible start + 1
+  while((p = memchr(p, nd[0], end - p)) != 0){
+    if(memcmp(p + 1, nd + 1, nn - 1) == 0)
+      return (void*)p;
+    p++;
+  }
+  return 0;
+}
+
 char*
 gets(char *buf, int max)
 {
@@ -140,11 +245,40 @@ memmove(void *vdst, const void *vsrc, int n)
   dst = vdst;
   src = vsrc;
   if (src > dst) {
+    while(n > 0 && !ALIGNED(dst)){
+      *dst++ = *src++;
+      n--;
+    }
+    if(ALIGNED(src)){
+      for(; n >= 8; n -= 8, src += 8, dst += 8)
+        *(word*)dst = *(word*)src;
+    } else if(n >= 8){
+      // build each word from two aligned loads of src; since
+      // dst < src nothing that is still to be read gets overwritten
+      int sh = ((uint64)src & 7) * 8;
+      const word *ws = (const word*)((uint64)src & ~7);
+      uint64 lo = *ws++, hi;
+      for(; n >= 8; n -= 8, src += 8, dst += 8){
+        hi = *ws++;
+        *(word*)dst = (lo >> sh) | (hi << (64 - sh));
+        lo = hi;
+      }
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if((((uint64)src ^ (uint64)dst) & 7) == 0){
+      while(n > 0 && !ALIGNED(dst)){
+        *--dst = *--src;
+        n--;
+      }
+      for(; n >= 8; n -= 8){
+        src -= 8, dst -= 8;
+        *(word*)dst = *(word*)src;
+      }
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -155,6 +289,12 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+  if((((uint64)p1 ^ (uint64)p2) & 7) == 0){
+    for(; n > 0 && !ALIGNED(p1) && *p1 == *p2; n--)
+      p1++, p2++;
+    for(; n >= 8 && ALIGNED(p1) && *(word*)p1 == *(word*)p2; n -= 8)
+      p1 += 8, p2 += 8;
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -3,88 +3,289 @@
 #include "user/user.h"
 #include "kernel/param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Size-class memory allocator.
+//
+// Memory comes from sbrk as runs of whole, page-aligned pages, and
+// every run starts with a struct page. A small request is rounded up
+// to one of the class sizes and served from a page that holds only
+// objects of that size. Each class keeps a list of its pages that
+// still have free objects, so malloc and free are O(1) for small
+// objects. A bigger request gets a run of its own. Free runs are kept
+// in address order and merged, and free pages at the top of the heap
+// beyond RETAIN are given back with sbrk(-n).
+//
+// free() finds the header by rounding the pointer down to its page.
+// There are no locks because a process has one thread; the class
+// lists would be where a lock goes.
 
-typedef long Align;
+#define PGSIZE  4096
+#define HDR     48      // sizeof(struct page), rounded up to 16
+#define NCLASS  12
+#define RETAIN  16      // free pages kept at the top of the heap
+#define LARGE   (-1)    // page.cls of a big object's run
+#define FREE    (-2)    // page.cls of a free run
 
-union header {
-  struct {
-    union header *ptr;
-    uint size;
-  } s;
-  Align x;
+struct obj {
+  struct obj *next;
 };
 
-typedef union header Header;
+struct page {
+  int cls;              // size class, LARGE or FREE
+  uint npage;           // pages in this run
+  uint nfree;           // small: free objects in the page
+  struct obj *free;     // small: the free objects
+  struct page *next;    // small: partial list; FREE: next run up
+  struct page *prev;    // small: partial list
+};
+
+static uint sizes[NCLASS] = {
+  16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 1008, 2016,
+};
+static struct page *partial[NCLASS];  // pages with a free object
+static struct page *runs;             // free runs, by address
+static char *top;                     // end of the last run from sbrk
+
+// for mallocstats()
+static uint npages[NCLASS], nused[NCLASS];
+static uint nlarge, largepages, heappages;
+
+#define END(r)  ((char*)(r) + (uint64)(r)->npage * PGSIZE)
+#define PAGEOF(p) ((struct page*)((uint64)(p) & ~(uint64)(PGSIZE-1)))
+
+// A run of npage pages: the tail of the first free run big enough,
+// else fresh pages from sbrk.
+static struct page*
+pagealloc(uint64 npage)
+{
+  struct page *r, **pp;
+  char *p;
+  uint64 pad;
+
+  for(pp = &runs; (r = *pp) != 0; pp = &r->next){
+    if(r->npage < npage)
+      continue;
+    if(r->npage == npage){
+      *pp = r->next;
+      return r;
+    }
+    r->npage -= npage;
+    r = (struct page*)END(r);
+    r->npage = npage;
+    return r;
+  }
+
+  if(npage > (0x7fffffff - PGSIZE) / PGSIZE)
+    return 0;
+  p = sbrk(0);
+  pad = -(uint64)p & (PGSIZE-1);   // the break may not be page aligned
+  if(sbrk(pad + npage * PGSIZE) == (char*)-1)
+    return 0;
+  r = (struct page*)(p + pad);
+  r->npage = npage;
+  top = END(r);
+  heappages += npage;
+  return r;
+}
+
+static void
+pagefree(struct page *r)
+{
+  struct page *p, *prev;
+  uint n;
+
+  r->cls = FREE;
+  prev = 0;
+  for(p = runs; p != 0 && p < r; p = p->next)
+    prev = p;
+  r->next = p;
+  if(prev)
+    prev->next = r;
+  else
+    runs = r;
+  if(p != 0 && END(r) == (char*)p){
+    r->npage += p->npage;
+    r->next = p->next;
+  }
+  if(prev != 0 && END(prev) == (char*)r){
+    prev->npage += r->npage;
+    prev->next = r->next;
+    r = prev;
+  }
+
+  // give back the top of the heap, unless someone else moved the break
+  if(END(r) == top && r->npage > RETAIN && sbrk(0) == top){
+    n = r->npage - RETAIN;
+    r->npage = RETAIN;
+    top -= (uint64)n * PGSIZE;
+    heappages -= n;
+    sbrk(-(n * PGSIZE));
+  }
+}
+
+static int
+classof(uint nbytes)
+{
+  int c;
+
+  for(c = 0; c < NCLASS; c++)
+    if(nbytes <= sizes[c])
+      return c;
+  return -1;
+}
+
+static void*
+smalloc(int c)
+{
+  struct page *pg;
+  struct obj *o;
+  char *p;
+
+  if((pg = partial[c]) == 0){
+    if((pg = pagealloc(1)) == 0)
+      return 0;
+    pg->cls = c;
+    pg->free = 0;
+    pg->nfree = 0;
+    // thread the objects from the end so they come out in address order
+    for(p = (char*)pg + HDR + ((PGSIZE-HDR)/sizes[c] - 1) * sizes[c];
+        p >= (char*)pg + HDR; p -= sizes[c]){
+      o = (struct obj*)p;
+      o->next = pg->free;
+      pg->free = o;
+      pg->nfree++;
+    }
+    pg->next = pg->prev = 0;
+    partial[c] = pg;
+    npages[c]++;
+  }
+  o = pg->free;
+  pg->free = o->next;
+  if(--pg->nfree == 0){
+    // full: off the partial list
+    partial[c] = pg->next;
+    if(pg->next)
+      pg->next->prev = 0;
+  }
+  nused[c]++;
+  return o;
+}
 
-static Header base;
-static Header *freep;
+static void
+sfree(struct page *pg, void *ap)
+{
+  struct obj *o = ap;
+  int c = pg->cls;
+
+  o->next = pg->free;
+  pg->free = o;
+  nused[c]--;
+  if(pg->nfree++ == 0){
+    pg->prev = 0;
+    pg->next = partial[c];
+    if(partial[c])
+      partial[c]->prev = pg;
+    partial[c] = pg;
+  } else if(pg->nfree == (PGSIZE-HDR)/sizes[c] && (pg->prev || pg->next)){
+    // empty and not the class's only partial page
+    if(pg->prev)
+      pg->prev->next = pg->next;
+    else
+      partial[c] = pg->next;
+    if(pg->next)
+      pg->next->prev = pg->prev;
+    npages[c]--;
+    pagefree(pg);
+  }
+}
 
 void
 free(void *ap)
 {
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
+  struct page *pg;
+
+  if(ap == 0)
+    return;
+  pg = PAGEOF(ap);
+  if(pg->cls == LARGE){
+    nlarge--;
+    largepages -= pg->npage;
+    pagefree(pg);
   } else
-    p->s.ptr = bp;
-  freep = p;
+    sfree(pg, ap);
 }
 
-static Header*
-morecore(uint nu)
+void*
+malloc(uint nbytes)
 {
-  char *p;
-  Header *hp;
+  struct page *pg;
+  int c;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == (char*)-1)
+  if((c = classof(nbytes)) >= 0)
+    return smalloc(c);
+  if((pg = pagealloc(((uint64)nbytes + HDR + PGSIZE - 1) / PGSIZE)) == 0)
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  pg->cls = LARGE;
+  nlarge++;
+  largepages += pg->npage;
+  return (char*)pg + HDR;
 }
 
 void*
-malloc(uint nbytes)
+realloc(void *ap, uint nbytes)
+{
+  struct page *pg;
+  uint size;
+  void *np;
+
+  if(ap == 0)
+    return malloc(nbytes);
+  pg = PAGEOF(ap);
+  size = pg->cls == LARGE ? pg->npage * PGSIZE - HDR : sizes[pg->cls];
+  if(nbytes <= size)
+    return ap;
+  if((np = malloc(nbytes)) == 0)
+    return 0;
+  memmove(np, ap, size);
+  free(ap);
+  return np;
+}
+
+void*
+calloc(uint n, uint size)
 {
-  Header *p, *prevp;
-  uint nunits;
+  uint64 total = (uint64)n * size;
+  void *p;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
+  if(total > 0xffffffff)
+    return 0;
+  if((p = malloc(total)) != 0)
+    memset(p, 0, total);
+  return p;
+}
+
+// Print where the heap's pages are and how full the class pages are.
+void
+mallocstats(void)
+{
+  struct page *r;
+  uint nrun, freepages, biggest, slots;
+  int c;
+
+  nrun = freepages = biggest = 0;
+  for(r = runs; r != 0; r = r->next){
+    nrun++;
+    freepages += r->npage;
+    if(r->npage > biggest)
+      biggest = r->npage;
   }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
-    }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+  printf("heap: %d pages, %d free in %d runs (largest %d)\n",
+         heappages, freepages, nrun, biggest);
+  printf("large: %d objects in %d pages\n", nlarge, largepages);
+  for(c = 0; c < NCLASS; c++){
+    if(npages[c] == 0)
+      continue;
+    slots = npages[c] * ((PGSIZE-HDR) / sizes[c]);
+    printf("class %d: %d pages, %d/%d used, %d bytes slack\n",
+           sizes[c], npages[c], nused[c], slots, (slots - nused[c]) * sizes[c]);
   }
 }
@@ -24,6 +24,7 @@ int sleep(int);
 int uptime(void);
 int setviflag(void);
 int eraseviflag(void);
+int lseek(int, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -38,8 +39,14 @@ uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
+void* realloc(void*, uint);
+void* calloc(uint, uint);
+void mallocstats(void);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
+void* memchr(const void*, int, uint);
+void* memrchr(const void*, int, uint);
+void* memmem(const void*, uint, const void*, uint);
 void *memcpy(void *, const void *, uint);
 char *safestrcpy(char *, const char *, int);
 int strncmp(const char *, const char *, uint);
\ No newline at end of file
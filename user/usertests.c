@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "user/re.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -575,6 +576,9 @@ writetest(char *s)
   }
 }
 
+// a file with double-indirect blocks, as big as the disk allows
+#define BIGFILE (MAXFILE < FSSIZE/2 ? MAXFILE : FSSIZE/2)
+
 void
 writebig(char *s)
 {
@@ -586,7 +590,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGFILE; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -606,7 +610,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGFILE){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -1778,50 +1782,70 @@ bigfile(char *s)
   unlink("bigfile.dat");
 }
 
+// A path of depth names, each a run of DIRSIZ digits, or
+// DIRSIZ+1 if bit i of big is set for the i'th name.
+static char*
+longpath(char *buf, int depth, int big)
+{
+  char *p = buf;
+  int i, j, len;
+
+  for(i = 0; i < depth; i++){
+    if(i > 0)
+      *p++ = '/';
+    len = DIRSIZ + ((big >> i) & 1);
+    for(j = 0; j < len; j++)
+      *p++ = '0' + (j + 1) % 10;
+  }
+  *p = 0;
+  return buf;
+}
+
 void
-fourteen(char *s)
+longname(char *s)
 {
+  char path[3*(DIRSIZ+2)];
   int fd;
 
-  // DIRSIZ is 14.
+  // names longer than DIRSIZ are cut to DIRSIZ characters.
 
-  if(mkdir("12345678901234") != 0){
-    printf("%s: mkdir 12345678901234 failed\n", s);
+  if(mkdir(longpath(path, 1, 0)) != 0){
+    printf("%s: mkdir %s failed\n", s, path);
     exit(1);
   }
-  if(mkdir("12345678901234/123456789012345") != 0){
-    printf("%s: mkdir 12345678901234/123456789012345 failed\n", s);
+  if(mkdir(longpath(path, 2, 2)) != 0){
+    printf("%s: mkdir %s failed\n", s, path);
     exit(1);
   }
-  fd = open("123456789012345/123456789012345/123456789012345", O_CREATE);
+  fd = open(longpath(path, 3, 7), O_CREATE);
   if(fd < 0){
-    printf("%s: create 123456789012345/123456789012345/123456789012345 failed\n", s);
+    printf("%s: create %s failed\n", s, path);
     exit(1);
   }
   close(fd);
-  fd = open("12345678901234/12345678901234/12345678901234", 0);
+  fd = open(longpath(path, 3, 0), 0);
   if(fd < 0){
-    printf("%s: open 12345678901234/12345678901234/12345678901234 failed\n", s);
+    printf("%s: open %s failed\n", s, path);
     exit(1);
   }
   close(fd);
 
-  if(mkdir("12345678901234/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/12345678901234 succeeded!\n", s);
+  if(mkdir(longpath(path, 2, 0)) == 0){
+    printf("%s: mkdir %s succeeded!\n", s, path);
     exit(1);
   }
-  if(mkdir("123456789012345/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/123456789012345 succeeded!\n", s);
+  if(mkdir(longpath(path, 2, 1)) == 0){
+    printf("%s: mkdir %s succeeded!\n", s, path);
     exit(1);
   }
 
   // clean up
-  unlink("123456789012345/12345678901234");
-  unlink("12345678901234/12345678901234");
-  unlink("12345678901234/12345678901234/12345678901234");
-  unlink("123456789012345/123456789012345/123456789012345");
-  unlink("12345678901234/123456789012345");
-  unlink("12345678901234");
+  unlink(longpath(path, 2, 1));
+  unlink(longpath(path, 2, 0));
+  unlink(longpath(path, 3, 0));
+  unlink(longpath(path, 3, 7));
+  unlink(longpath(path, 2, 2));
+  unlink(longpath(path, 1, 0));
 }
 
 void
@@ -2571,6 +2595,144 @@ badarg(char *s)
   exit(0);
 }
 
+// regular expressions: '^' branches of an alternation must not be
+// lost by the literal-prefix shortcut, and a match from the middle
+// of a line must not take that place for the line beginning.
+void
+regexalt(char *s)
+{
+  static struct {
+    char *pat, *text;
+    int from, start, len;
+  } cases[] = {
+    { "^b|ab", "b", 0, 0, 1 },
+    { "^b|ab", "xab", 0, 1, 2 },
+    { "^.|a", "caca", 0, 0, 1 },
+    { "^a|b", "ab", 1, 1, 1 },
+    { "a|^b", "ab", 1, -1, 0 },
+    { "^a", "aa", 1, -1, 0 },
+  };
+  re_t re;
+  int i, r, len;
+
+  for(i = 0; i < sizeof(cases)/sizeof(cases[0]); i++){
+    re = re_compile(cases[i].pat);
+    r = re_matchfrom(re, cases[i].text, cases[i].from, &len);
+    if(r != cases[i].start || (r >= 0 && len != cases[i].len)){
+      printf("%s: %s on %s from %d: %d,%d not %d,%d\n", s, cases[i].pat,
+             cases[i].text, cases[i].from, r, len, cases[i].start, cases[i].len);
+      exit(1);
+    }
+  }
+}
+
+// create file holding the n bytes of data
+void
+vifile(char *s, char *file, char *data, int n)
+{
+  int fd;
+
+  unlink(file);
+  fd = open(file, O_CREATE|O_WRONLY);
+  if(fd < 0 || write(fd, data, n) != n){
+    printf("%s: create %s failed\n", s, file);
+    exit(1);
+  }
+  close(fd);
+}
+
+// run vi on file with keys as its input, the screen goes to a file
+void
+virun(char *s, char *file, char *keys)
+{
+  char *argv[] = { "vi", file, 0 };
+  int fds[2], pid, xstatus;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  write(fds[1], keys, strlen(keys));
+  close(fds[1]);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    dup(fds[0]);
+    close(fds[0]);
+    close(1);
+    if(open("vialias.out", O_CREATE|O_WRONLY) != 1)
+      exit(1);
+    exec("vi", argv);
+    exit(1);
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  unlink("vialias.out");
+  if(xstatus != 0){
+    printf("%s: vi failed\n", s);
+    exit(1);
+  }
+}
+
+// check that file holds the n bytes of want, and remove it
+void
+vicheck(char *s, char *file, char *want, int n)
+{
+  static char got[2048];
+  int fd, m;
+
+  fd = open(file, O_RDONLY);
+  if(fd < 0){
+    printf("%s: open %s failed\n", s, file);
+    exit(1);
+  }
+  m = read(fd, got, sizeof(got));
+  close(fd);
+  unlink(file);
+  if(m != n || memcmp(got, want, n) != 0){
+    printf("%s: %s has %d bytes, not the %d saved\n", s, file, m, n);
+    exit(1);
+  }
+}
+
+// vi writing over a file that a buffer is loading, through another
+// path or a hard link, must not truncate it before copying the lines
+// that were never read in. Holes of another buffer count as well.
+void
+vialias(char *s)
+{
+  static char want[1600];
+  int i, j;
+
+  for(i = 0; i < sizeof(want)/8; i++){
+    for(j = 0; j < 7; j++)
+      want[i*8+j] = 'a' + (i + j) % 26;
+    want[i*8+7] = '\n';
+  }
+  vifile(s, "vialias", want, sizeof(want));
+  unlink("vialias2");
+  if(link("vialias", "vialias2") < 0){
+    printf("%s: link failed\n", s);
+    exit(1);
+  }
+
+  virun(s, "vialias", ":w ./vialias\r:w vialias2\r:q\r");
+  vicheck(s, "vialias", want, sizeof(want));
+  vicheck(s, "vialias2", want, sizeof(want));
+
+  // buffer 2 saves over the file buffer 1 still reads
+  vifile(s, "vialias", want, sizeof(want));
+  vifile(s, "viother", "x\n", 2);
+  virun(s, "vialias", ":e viother\r:w ./vialias\r:b 1\r:w vialias3\r:q\r");
+  vicheck(s, "vialias3", want, sizeof(want));
+  vicheck(s, "vialias", "x\n", 2);
+  unlink("viother");
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2613,7 +2775,7 @@ struct test {
   {subdir, "subdir"},
   {bigwrite, "bigwrite"},
   {bigfile, "bigfile"},
-  {fourteen, "fourteen"},
+  {longname, "longname"},
   {rmdot, "rmdot"},
   {dirfile, "dirfile"},
   {iref, "iref"},
@@ -2635,6 +2797,8 @@ struct test {
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
   {badarg, "badarg" },
+  {regexalt, "regexalt"},
+  {vialias, "vialias"},
 
   { 0, 0},
 };
@@ -2837,7 +3001,7 @@ diskfull(char *s)
       break;
     }
     for(int i = 0; i < MAXFILE; i++){
-      char buf[BSIZE];
+      // the global buf: BSIZE may be the whole user stack
       if(write(fd, buf, BSIZE) != BSIZE){
         done = 1;
         close(fd);
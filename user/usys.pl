@@ -38,3 +38,4 @@ entry("sleep");
 entry("uptime");
 entry("setviflag");
 entry("eraseviflag");
+entry("lseek");
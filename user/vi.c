@@ -9,6 +9,7 @@
 //  actual screen height is SCREEN_HEIGHT+1
 #define SCREEN_WIDTH 30
 #define SCREEN_HEIGHT 20
+#define MAX_WINDOWS 4  // horizontal splits, each followed by a name line
 
 // line buffer length
 #define LINE_BUFFER_LENGTH 128
@@ -33,6 +34,28 @@
 #define KEYCODE_DELETE 127
 #define KEYCODE_TAB 0x9
 #define KEYCODE_CTRL_L 0x0c
+#define KEYCODE_CTRL_R 0x12
+#define KEYCODE_CTRL_F 0x06
+#define KEYCODE_CTRL_B 0x02
+#define KEYCODE_CTRL_G 0x07
+#define KEYCODE_CTRL_W 0x17
+
+// file
+#define FILE_BLOCK 4096         // bytes per read when loading and saving
+#define LINE_INDEX_STRIDE 64    // one file offset is kept per this many lines
+#define INDEX_BUDGET 65536      // bytes indexed between two keystrokes
+#define LINE_CACHE 1024         // lines read in between two line_evict passes
+#define SAVE_TMPFILE "vi.swp"   // written first when saving over the open file
+
+// undo journal
+//  budget in bytes, oldest edits are dropped beyond it
+#define UNDO_BUDGET 65536
+#define EDIT_INSERT 1   // text inserted into line at x
+#define EDIT_DELETE 2   // text deleted from line at x
+#define EDIT_SPLIT 3    // line split at x, tail moved to aux
+#define EDIT_JOIN 4     // aux appended to line at x and unlinked
+#define EDIT_PUTLINE 5  // aux linked after line
+#define EDIT_DELLINE 6  // aux unlinked from after line
 
 // esc sequence
 #define term_cursor_location(x, y) fprintf(stdout, "\033[%d;%dH", y, x)
@@ -46,18 +69,35 @@
 // globals
 int mode;
 int command;
+int pending_g;  // 1 after a 'g' waiting for the second key of gg
 int quit_flg;
 // 1表示有更改要重画屏幕，0表示不用
 int is_change = 1;
 
 int is_hightlight = 1;
 
+// 当前buffer的文字被修改过但还未保存
+int modified;
+// bumped on every text change, tells other windows on the buffer to redraw
+int text_version;
+
 struct linebuffer {
   char *buf;
   int size;
   struct linebuffer *prev;
   struct linebuffer *next;
   int dirty;  // 0表示为未修改，1表示当前行要重新渲染，2表示当前行要重新渲染且接下来的行要重新渲染
+  // line index, see index_insert
+  struct linebuffer *left;
+  struct linebuffer *right;
+  struct linebuffer *parent;
+  int count;
+  uint prio;
+  // lines this node stands for, 1 unless it is a hole (buf == 0), see hole_split
+  int nline;
+  int first;
+  uint off;
+  int clean;  // buf还是文件第first行的原样，可以放回空洞，see line_evict
 } linebuffer_head, linebuffer_tail;
 
 struct cursor {
@@ -76,8 +116,28 @@ struct statusbar {
 struct screen {
   int line;
   struct linebuffer *upperline;
+  int row;     // terminal row of upperline
+  int height;  // lines shown
 } screen;
 
+// cursor and first screen line by number, kept while a window or buffer
+// is not current; line pointers may not survive edits made elsewhere
+struct view {
+  int x;
+  int y;
+  int top;
+};
+
+struct window {
+  struct buffer *buf;
+  struct view view;
+  int row;
+  int height;
+  int version;  // text_version of buf when last drawn
+} windows[MAX_WINDOWS];
+int nwindow;
+int curwin;
+
 struct linebuffer *last_delete_line = 0;
 
 enum colorenum {
@@ -106,7 +166,7 @@ char colors[][9] = {"\e[1;37m", "\e[1;31m", "\e[1;32m", "\e[1;33m", "\e[1;34m",
 struct keywrod {
   enum colorenum color;
   char *word;
-  int flag;
+  int flag;  // 1表示只匹配完整的单词
 };
 
 enum colorenum word_color[LINE_BUFFER_LENGTH];
@@ -133,15 +193,34 @@ struct keywrod keywords[] = {{RED, "(", 0},
                              {GREEN, "}", 0},
                              {YELLOW, "[", 0},
                              {YELLOW, "]", 0},
-                             {BLUE, "\\b?if\\b?", 1},
-                             {BLUE, "\\b?else\\b?", 1},
-                             {BLUE, "\\b?while\\b?", 1},
-                             {MAGENTA, "\\b?for\\b?", 1},
-                             {MAGENTA, "\\b?include\\b?", 1},
-                             {CYAN, "\\b?int\\b?", 1},
-                             {BRIGHT_RED, "\\b?double\\b?", 1},
-                             {BRIGHT_GREEN, "\\b?printf\\b?", 1},
-                             {BLUE, "\\b?break\\b?", 1}};
+                             {BLUE, "if", 1},
+                             {BLUE, "else", 1},
+                             {BLUE, "while", 1},
+                             {MAGENTA, "for", 1},
+                             {MAGENTA, "include", 1},
+                             {CYAN, "int", 1},
+                             {BRIGHT_RED, "double", 1},
+                             {BRIGHT_GREEN, "printf", 1},
+                             {BLUE, "break", 1}};
+
+// keyword matcher
+//  all keywords are compiled into one Aho-Corasick automaton with every
+//  failure transition resolved in advance, so a line is highlighted in a
+//  single pass whatever the number of keywords. Bytes that appear in no
+//  keyword share class 0.
+#define AC_MAX_NODES 128
+#define AC_MAX_CLASSES 64
+
+struct acmatcher {
+  int nnode;
+  int ncls;
+  uchar cls[256];
+  short next[AC_MAX_NODES][AC_MAX_CLASSES];
+  short fail[AC_MAX_NODES];
+  short out[AC_MAX_NODES];   // keyword ending here, -1 if none
+  short dict[AC_MAX_NODES];  // nearest node on the fail chain with an out, 0 if none
+  uchar len[KEYWORD_NUM];
+} ac;
 
 char find_str[FIND_STR_LENGTH + 1];
 
@@ -150,8 +229,23 @@ char outputfilename[64];
 
 // protos
 void save();
+int buffer_reads(char *name);
 void load();
 void quit();
+void goto_line(int n);
+struct linebuffer *line_next(struct linebuffer *lbp);
+struct linebuffer *line_prev(struct linebuffer *lbp);
+struct linebuffer *hole_split(struct linebuffer *h, int r);
+void index_until(int n);
+void index_all();
+void window_display(int i, int full);
+void window_split(char *name);
+void window_close();
+void buffer_edit(char *name);
+void buffer_next(int dir);
+void buffer_goto(int id);
+void buffer_list();
+char *putint(char *p, int n);
 
 // screen
 void screen_init() {
@@ -161,14 +255,14 @@ void screen_init() {
 
 void screen_up() {
   if (screen.upperline->prev == &linebuffer_head) return;
-  screen.upperline = screen.upperline->prev;
+  screen.upperline = line_prev(screen.upperline);
   screen.line--;
   is_change = 1;
 }
 
 void screen_down() {
-  if (screen.upperline->next == &linebuffer_tail) return;
-  screen.upperline = screen.upperline->next;
+  if (line_next(screen.upperline) == &linebuffer_tail) return;
+  screen.upperline = line_next(screen.upperline);
   screen.line++;
   is_change = 1;
 }
@@ -180,10 +274,10 @@ int is_screen_down() {
   struct linebuffer *lbp;
 
   lbp = screen.upperline;
-  for (i = 1; i < SCREEN_HEIGHT; i++) {
-    lbp = lbp->next;
+  for (i = 1; i < screen.height; i++) {
+    lbp = line_next(lbp);
   }
-  return lbp->next == cursor.linebuffer;
+  return line_next(lbp) == cursor.linebuffer;
 }
 
 struct linebuffer *screen_top() {
@@ -209,13 +303,13 @@ void terminal_cursor_update() {
     term_cursor_location(STATUSBAR_MESSAGE_START + statusbar.msglength,
                          SCREEN_HEIGHT + 1);
   } else {
-    term_cursor_location(cursor.x + 1, cursor.y - screen.line + 1);
+    term_cursor_location(cursor.x + 1, screen.row + cursor.y - screen.line);
   }
 }
 
 void cursor_up() {
   if (cursor.linebuffer->prev == &linebuffer_head) return;
-  cursor.linebuffer = cursor.linebuffer->prev;
+  cursor.linebuffer = line_prev(cursor.linebuffer);
   cursor.y--;
   if (cursor.y == 0) {
     exit(-1);
@@ -226,8 +320,8 @@ void cursor_up() {
 }
 
 void cursor_down() {
-  if (cursor.linebuffer->next == &linebuffer_tail) return;
-  cursor.linebuffer = cursor.linebuffer->next;
+  if (line_next(cursor.linebuffer) == &linebuffer_tail) return;
+  cursor.linebuffer = line_next(cursor.linebuffer);
   cursor.y++;
   if (cursor.x > cursor.linebuffer->size) cursor.x = cursor.linebuffer->size;
 
@@ -242,51 +336,52 @@ void cursor_right() {
   if (cursor.x < cursor.linebuffer->size) cursor.x++;
 }
 
-void printline(struct linebuffer *lbp) {
-  lbp->dirty = 0;
-
-  int i = 0;
-  char *p = lbp->buf;
-
-  memset(word_color, 0, sizeof(word_color));
-
-  while (i < lbp->size) {
-    while (i < lbp->size && p[i] == ' ') {
-      printf(" ");
-      i++;
-    }
-
-    if (i >= lbp->size) {
-      break;
-    }
-    int j = i;
-    int size = 0;
-    while (j < lbp->size && p[j] != ' ') {
-      j++;
-    }
-    size = j - i;
-    char *str = (char *)malloc(size + 1);
-    safestrcpy(str, p + i, size + 1);
-
-    int rematch_length = -1;
-    for (int k = 0; k < KEYWORD_NUM; k++) {
-      int idx = re_match(keywords[k].word, str, &rematch_length);
-      if (idx != -1) {
-        int w_index = 0;
-        while (w_index < rematch_length) {
-          word_color[idx + w_index] = (int)keywords[k].color;
-          w_index++;
-        }
+void ac_build() {
+  short queue[AC_MAX_NODES];
+  int head = 0, tail = 0;
+  int k, c, u, v, f;
+  char *w;
+
+  memset(&ac, 0, sizeof(ac));
+  ac.nnode = 1;
+  ac.ncls = 1;
+  ac.out[0] = -1;
+  // trie
+  for (k = 0; k < KEYWORD_NUM; k++) {
+    u = 0;
+    for (w = keywords[k].word; *w != '\0'; w++) {
+      if (ac.cls[(uchar)*w] == 0 && ac.ncls < AC_MAX_CLASSES) {
+        ac.cls[(uchar)*w] = ac.ncls++;
       }
+      c = ac.cls[(uchar)*w];
+      if (ac.next[u][c] == 0) {
+        if (ac.nnode == AC_MAX_NODES) break;
+        ac.out[ac.nnode] = -1;
+        ac.next[u][c] = ac.nnode++;
+      }
+      u = ac.next[u][c];
     }
-    for (int k = 0; k < strlen(str); k++) {
-      printf("%s%c%s", colors[word_color[k]], str[k], COLOR_clear);
+    ac.out[u] = k;
+    ac.len[k] = w - keywords[k].word;
+  }
+  // breadth first: fail links, dictionary links and the missing transitions
+  for (c = 0; c < ac.ncls; c++) {
+    if ((v = ac.next[0][c]) != 0) queue[tail++] = v;
+  }
+  while (head < tail) {
+    u = queue[head++];
+    f = ac.fail[u];
+    ac.dict[u] = ac.out[f] >= 0 ? f : ac.dict[f];
+    for (c = 0; c < ac.ncls; c++) {
+      v = ac.next[u][c];
+      if (v == 0) {
+        ac.next[u][c] = ac.next[f][c];
+      } else {
+        ac.fail[v] = ac.next[f][c];
+        queue[tail++] = v;
+      }
     }
-    memset(word_color, 0, size * sizeof(int));
-    free(str);
-    i = j;
   }
-  printf("\n");
 }
 
 int matchwordedge(char c)
@@ -298,24 +393,24 @@ void printline1(struct linebuffer *lbp) {
   lbp->dirty = 0;
 
   char *p = lbp->buf;
+  int u = 0;
 
   memset(word_color, 0, sizeof(word_color));
 
-  for (int k = 0; k < KEYWORD_NUM; k++) {
-    int idx;
-    int len;
-    int i = 0;
-    re_t regex = re_compile(keywords[k].word);
-    while (i < lbp->size &&
-           (idx = re_matchp(regex, p + i, &len)) != -1) {
-      int w_index = 0;
-      while (w_index < len) {
-        if (!keywords[k].flag || !matchwordedge(p[idx + w_index])) {
-          word_color[idx + w_index] = (int)keywords[k].color;
-        }
-        w_index++;
+  for (int j = 0; j < lbp->size; j++) {
+    u = ac.next[u][ac.cls[(uchar)p[j]]];
+    // every keyword ending at j: u itself, then its dictionary links
+    for (int v = ac.out[u] >= 0 ? u : ac.dict[u]; v != 0; v = ac.dict[v]) {
+      int k = ac.out[v];
+      int start = j + 1 - ac.len[k];
+      if (keywords[k].flag &&
+          ((start > 0 && !matchwordedge(p[start - 1])) ||
+           (j + 1 < lbp->size && !matchwordedge(p[j + 1])))) {
+        continue;
+      }
+      for (int w = start; w <= j; w++) {
+        word_color[w] = keywords[k].color;
       }
-      i += idx + len;
     }
   }
   for (int j = 0; j < lbp->size; j++) {
@@ -326,51 +421,49 @@ void printline1(struct linebuffer *lbp) {
 }
 
 // display
-void display(struct linebuffer *head) {
-  int i, v;
-  struct linebuffer *lbp;
-
-  v = statusbar.visibility == STATUSBAR_VISIBLE;
-  i = v ? SCREEN_HEIGHT : SCREEN_HEIGHT - 1;
-  lbp = head;
-
-  if (is_change) {
-    term_cursor_location(0, 0);
-    fprintf(stdout, "\033[2J");
-    while (i-- > 0) {
+// 从第row行起画height行，full为0时只画dirty的行
+void display_lines(struct linebuffer *lbp, int row, int height, int full) {
+  int j;
+
+  for (j = 0; j < height; j++) {
+    if (full || lbp->dirty > 0) {
+      if (lbp->dirty == 2) {
+        // the lines below moved
+        full = 1;
+      }
+      term_cursor_location(0, row + j);
+      printf("\033[2K");
       if (is_hightlight) {
         fprintf(stdout, "%s\n", lbp->buf);
+        lbp->dirty = 0;
       } else {
         printline1(lbp);
       }
-      lbp = lbp->next;
     }
-  } else {
-    int j = 1;
-    while (j <= i) {
-      term_cursor_location(0, j);
-      if (is_change || lbp->dirty > 0) {
-        if (lbp->dirty == 2) {
-          is_change = 1;
-        }
+    lbp = line_next(lbp);
+  }
+}
 
-        printf("\033[2K");
-        if (is_hightlight) {
-          fprintf(stdout, "%s\n", lbp->buf);
-        } else {
-          printline1(lbp);
-        }
-      }
-      lbp = lbp->next;
-      j++;
-    }
-    // clear the status bar
-    term_cursor_location(0, SCREEN_HEIGHT + 1);
-    printf("\033[2K");
-    term_cursor_location(0, SCREEN_HEIGHT + 1);
+void display() {
+  int i;
+
+  if (is_change) {
+    term_cursor_location(0, 0);
+    fprintf(stdout, "\033[2J");
+  }
+  // the current window first: it clears the dirty marks the others skip
+  window_display(curwin, is_change);
+  for (i = 0; i < nwindow; i++) {
+    if (i != curwin) window_display(i, is_change);
   }
 
-  if (v) fprintf(stdout, "%s  %s", statusbar.mode, statusbar.msg);
+  // clear the status bar
+  term_cursor_location(0, SCREEN_HEIGHT + 1);
+  printf("\033[2K");
+  term_cursor_location(0, SCREEN_HEIGHT + 1);
+  if (statusbar.visibility == STATUSBAR_VISIBLE) {
+    fprintf(stdout, "%s  %s", statusbar.mode, statusbar.msg);
+  }
 
   terminal_cursor_update();
   is_change = 0;
@@ -431,6 +524,12 @@ void statusbar_command_end() {
   clear_statusbar_message();
 }
 
+// 结束命令行并显示消息
+void command_message(char *msg) {
+  statusbar_command_end();
+  set_statusbar_message(msg);
+}
+
 void statusbar_command_exec() {
   int i;
   char *arg1, *arg2;
@@ -449,8 +548,29 @@ void statusbar_command_exec() {
   switch (*arg1) {
     case 'e':
       if (*arg2 != '\0') {
-        strcpy(inputfilename, arg2);
-        load();
+        buffer_edit(arg2);
+      }
+      break;
+    case 'b':
+      if (*arg2 == 'n') {
+        buffer_next(1);
+      } else if (*arg2 == 'p') {
+        buffer_next(-1);
+      } else if (isdigit(*arg2)) {
+        buffer_goto(atoi(arg2));
+      }
+      break;
+    case 'l':
+      if (*arg2 == 's') {
+        buffer_list();
+      }
+      break;
+    case 's':
+      if (*arg2 == 'p') {
+        arg2++;
+        while (*arg2 != ' ' && *arg2 != '\0') arg2++;
+        while (*arg2 == ' ') arg2++;
+        window_split(arg2);
       }
       break;
     case 'w':
@@ -465,16 +585,169 @@ void statusbar_command_exec() {
       save();
       break;
     case 'q':
-      quit();
+      window_close();
       break;
     default:
+      if (isdigit(*arg1)) {
+        goto_line(atoi(arg1));
+      }
       break;
   }
-  clear_statusbar_message();
+  if (command) {
+    clear_statusbar_message();
+  }
 }
 
 void error(char *msg) { set_statusbar_message(msg); }
 
+// line index
+//  the lines are also kept in an implicit treap ordered like the list,
+//  each node caching the size of its subtree, so finding the n-th line
+//  and the number of a line are O(log n). head and tail are not in it.
+struct linebuffer *line_root;
+uint line_seed = 2463534242;
+
+uint line_rand() {
+  line_seed ^= line_seed << 13;
+  line_seed ^= line_seed >> 17;
+  line_seed ^= line_seed << 5;
+  return line_seed;
+}
+
+int subtree_count(struct linebuffer *t) { return t != NULL ? t->count : 0; }
+
+// lines known so far, the file behind fmap.rest may not be fully indexed
+int line_count() { return subtree_count(line_root); }
+
+// t代表的行数改变delta
+void index_reweight(struct linebuffer *t, int delta) {
+  t->nline += delta;
+  for (; t != NULL; t = t->parent) t->count += delta;
+}
+
+// 将x旋转到其父节点的位置
+void index_rotate(struct linebuffer *x) {
+  struct linebuffer *p = x->parent, *g = p->parent;
+
+  if (p->left == x) {
+    p->left = x->right;
+    if (x->right != NULL) x->right->parent = p;
+    x->right = p;
+  } else {
+    p->right = x->left;
+    if (x->left != NULL) x->left->parent = p;
+    x->left = p;
+  }
+  p->parent = x;
+  x->parent = g;
+  if (g == NULL) {
+    line_root = x;
+  } else if (g->left == p) {
+    g->left = x;
+  } else {
+    g->right = x;
+  }
+  x->count = p->count;
+  p->count = p->nline + subtree_count(p->left) + subtree_count(p->right);
+}
+
+// 将lbp插入到prev之后，prev为&linebuffer_head时插入到最前面
+void index_insert(struct linebuffer *prev, struct linebuffer *lbp) {
+  struct linebuffer *p;
+
+  lbp->left = lbp->right = lbp->parent = NULL;
+  lbp->count = lbp->nline;
+  if (line_root == NULL) {
+    line_root = lbp;
+    return;
+  }
+
+  if (prev == &linebuffer_head) {
+    for (p = line_root; p->left != NULL; p = p->left)
+      ;
+    p->left = lbp;
+  } else if (prev->right == NULL) {
+    p = prev;
+    p->right = lbp;
+  } else {
+    for (p = prev->right; p->left != NULL; p = p->left)
+      ;
+    p->left = lbp;
+  }
+  lbp->parent = p;
+  for (; p != NULL; p = p->parent) p->count += lbp->nline;
+
+  while (lbp->parent != NULL && lbp->prio > lbp->parent->prio) {
+    index_rotate(lbp);
+  }
+}
+
+void index_remove(struct linebuffer *lbp) {
+  struct linebuffer *c, *p;
+
+  // rotate lbp down to a leaf, then cut it off
+  while (lbp->left != NULL || lbp->right != NULL) {
+    if (lbp->left == NULL) {
+      c = lbp->right;
+    } else if (lbp->right == NULL) {
+      c = lbp->left;
+    } else {
+      c = lbp->left->prio > lbp->right->prio ? lbp->left : lbp->right;
+    }
+    index_rotate(c);
+  }
+
+  p = lbp->parent;
+  if (p == NULL) {
+    line_root = NULL;
+  } else if (p->left == lbp) {
+    p->left = NULL;
+  } else {
+    p->right = NULL;
+  }
+  for (; p != NULL; p = p->parent) p->count -= lbp->nline;
+  lbp->parent = NULL;
+}
+
+// 返回lbp(的第一行)的行号，从1开始
+int line_number(struct linebuffer *lbp) {
+  int n = subtree_count(lbp->left) + 1;
+
+  for (; lbp->parent != NULL; lbp = lbp->parent) {
+    if (lbp->parent->right == lbp) {
+      n += subtree_count(lbp->parent->left) + lbp->parent->nline;
+    }
+  }
+  return n;
+}
+
+// 返回第n行，n超出范围时取第一行或最后一行，落在空洞中时从文件读入
+//  没有任何行时返回0，load和buffer_open保证这不会发生
+struct linebuffer *line_at(int n) {
+  struct linebuffer *t = line_root;
+  int l = 0;
+
+  index_until(n);
+  if (line_count() == 0) return NULL;
+  if (n < 1) n = 1;
+  if (n > line_count()) n = line_count();
+  while (t != NULL) {
+    l = subtree_count(t->left);
+    if (n <= l) {
+      t = t->left;
+    } else if (n <= l + t->nline) {
+      break;
+    } else {
+      n -= l + t->nline;
+      t = t->right;
+    }
+  }
+  if (t->buf == NULL) {
+    t = hole_split(t, n - l - 1);
+  }
+  return t;
+}
+
 // buffer
 void link_linebuffer(struct linebuffer *l, struct linebuffer *r) {
   l->next = r;
@@ -485,10 +758,20 @@ void link_linebuffer(struct linebuffer *l, struct linebuffer *r) {
 
 void alloc_linebuffer(struct linebuffer *lb) {
   lb->buf = malloc(LINE_BUFFER_LENGTH);
+  memset(lb->buf, '\0', LINE_BUFFER_LENGTH);
   lb->size = 0;
   lb->prev = 0;
   lb->next = 0;
   lb->dirty = 0;
+  lb->left = 0;
+  lb->right = 0;
+  lb->parent = 0;
+  lb->count = 1;
+  lb->prio = line_rand();
+  lb->nline = 1;
+  lb->first = 0;
+  lb->off = 0;
+  lb->clean = 0;
 }
 
 struct linebuffer *create_linebuffer() {
@@ -511,264 +794,1506 @@ int merge_linebuffer(struct linebuffer *lhs, struct linebuffer *rhs) {
   return 1;
 }
 
-// mode
-void mode_change(int m) {
-  mode = m;
-  switch (m) {
-    case MODE_INSERT:
-      set_statusbar_mode("-- INSERT --");
-      return;
-    case MODE_NORMAL:
-      set_statusbar_mode("-- NORMAL --");
-      return;
-  }
+// file
+//  a file is not read in when loaded. Lines that were never touched stay
+//  in the list as holes (buf == 0) standing for nline lines of the file
+//  starting at line first / byte off; holes are split into real lines
+//  only when the cursor, the screen or a search reaches them, and lines
+//  still unchanged are turned back into holes once they are far from
+//  every window, see line_evict. The last hole, fmap.rest, also grows as
+//  the line offsets are indexed, a block at a time between keystrokes.
+struct linereader {
+  int fd;
+  uint off;  // file offset of blk[0]
+  int pos;
+  int len;
+  char blk[FILE_BLOCK];
+};
+
+struct filemap {
+  int fd;          // -1 when the text is not backed by a file
+  char name[64];
+  uint *mark;      // mark[i] is the offset of line i*LINE_INDEX_STRIDE
+  int nmark;
+  int capmark;
+  int nindexed;    // lines indexed so far
+  int done;        // 1 once the whole file is indexed
+  int nread;       // lines read from holes since the last line_evict
+  struct linebuffer *rest;
+  struct linereader idx;  // indexing position
+} fmap = {-1};
+
+// reader for random access, used to fill holes and to copy them on save
+struct linereader rd;
+
+void reader_seek(struct linereader *r, int fd, uint off) {
+  r->fd = fd;
+  r->off = off;
+  r->pos = 0;
+  r->len = 0;
 }
 
-void change_hightlight() {
-  if (is_hightlight) {
-    is_hightlight = 0;
-    is_change = 1;
-    error("syntax hightlight on");
-    return;
+uint reader_tell(struct linereader *r) { return r->off + r->pos; }
+
+int reader_getc(struct linereader *r) {
+  if (r->pos == r->len) {
+    // fmap.idx and rd share the fd, so always seek before reading
+    r->off += r->len;
+    r->pos = 0;
+    lseek(r->fd, r->off, SEEK_SET);
+    r->len = read(r->fd, r->blk, FILE_BLOCK);
+    if (r->len <= 0) {
+      r->len = 0;
+      return -1;
+    }
   }
-  is_hightlight = 1;
-  is_change = 1;
-  error("syntax hightlight off");
+  return (uchar)r->blk[r->pos++];
 }
 
-void delete_normal() {
-  if (cursor.x == cursor.linebuffer->size) return;
-  // is_change = 1;
-  cursor.linebuffer->dirty = 1;
-
-  memmove(cursor.linebuffer->buf + cursor.x,
-          cursor.linebuffer->buf + cursor.x + 1,
-          cursor.linebuffer->size - cursor.x);
+// 读一行到buf，不含\n，返回长度，文件尾返回-1
+//  长于LINE_BUFFER_LENGTH-1的行被拆成多行，紧跟其后的\n仍属于该行
+int reader_line(struct linereader *r, char *buf) {
+  int c, n = 0;
 
-  cursor.linebuffer->buf[cursor.linebuffer->size] = '\0';
-  if (cursor.linebuffer->size > 0) cursor.linebuffer->size--;
-
-  if (cursor.x > cursor.linebuffer->size) {
-    cursor.x = cursor.linebuffer->size;
+  while ((c = reader_getc(r)) >= 0) {
+    if (c == '\n') break;
+    buf[n++] = c;
+    if (n == LINE_BUFFER_LENGTH - 1) {
+      if ((c = reader_getc(r)) >= 0 && c != '\n') r->pos--;
+      break;
+    }
   }
+  buf[n] = '\0';
+  if (c < 0 && n == 0) return -1;
+  return n;
 }
 
-void deleteline_normal() {
-  struct linebuffer *p, *n;
+// 返回文件第i行(从0开始)的偏移，i可以等于总行数，此时为文件尾
+uint file_line_offset(int i) {
+  char buf[LINE_BUFFER_LENGTH];
+  int k;
 
-  p = cursor.linebuffer->prev;
-  n = cursor.linebuffer->next;
+  if (i >= fmap.nindexed) {
+    return reader_tell(&fmap.idx);
+  }
+  reader_seek(&rd, fmap.fd, fmap.mark[i / LINE_INDEX_STRIDE]);
+  for (k = i % LINE_INDEX_STRIDE; k > 0; k--) {
+    reader_line(&rd, buf);
+  }
+  return reader_tell(&rd);
+}
 
-  // is_change = 1;
+void file_mark(uint off) {
+  uint *mark;
 
-  if (p == &linebuffer_head && n == &linebuffer_tail) {
-    
-    // 保存删除的行以便等会复制时恢复
-    if (last_delete_line != NULL) {
-      free(last_delete_line->buf);
-      free(last_delete_line);
+  if (fmap.nmark == fmap.capmark) {
+    fmap.capmark = fmap.capmark ? fmap.capmark * 2 : 64;
+    mark = malloc(fmap.capmark * sizeof(uint));
+    if (fmap.mark != NULL) {
+      memmove(mark, fmap.mark, fmap.nmark * sizeof(uint));
+      free(fmap.mark);
     }
-    last_delete_line = create_linebuffer();
-    memcpy(last_delete_line->buf, cursor.linebuffer->buf, LINE_BUFFER_LENGTH);
-    last_delete_line->size = cursor.linebuffer->size;
-
-    memset(cursor.linebuffer->buf, '\0', LINE_BUFFER_LENGTH);
-    cursor.linebuffer->size = 0;
-    cursor.x = 0;
-    cursor.y = 1;
-    cursor.linebuffer->dirty = 2;
-    return;
+    fmap.mark = mark;
   }
+  fmap.mark[fmap.nmark++] = off;
+}
 
-  if (cursor.linebuffer == screen.upperline) {
-    screen.upperline = cursor.linebuffer->next;
+// 索引最多INDEX_BUDGET字节，新找到的行加入fmap.rest
+void index_more() {
+  char buf[LINE_BUFFER_LENGTH];
+  uint start, limit;
+  int n = 0;
+
+  if (fmap.done) return;
+  limit = reader_tell(&fmap.idx) + INDEX_BUDGET;
+  while (reader_tell(&fmap.idx) < limit) {
+    start = reader_tell(&fmap.idx);
+    if (reader_line(&fmap.idx, buf) < 0) {
+      fmap.done = 1;
+      break;
+    }
+    if (fmap.nindexed % LINE_INDEX_STRIDE == 0) {
+      file_mark(start);
+    }
+    fmap.nindexed++;
+    n++;
   }
-  link_linebuffer(p, n);
+  index_reweight(fmap.rest, n);
+}
 
-  // 保存删除的行以便等会复制时恢复
-  if (last_delete_line != NULL) {
-    free(last_delete_line->buf);
-    free(last_delete_line);
-  }
-  last_delete_line = cursor.linebuffer;
+// 至少索引到第n行或文件尾
+void index_until(int n) {
+  while (!fmap.done && line_count() < n) index_more();
+}
 
-  cursor.linebuffer = n;
-  cursor_up();
-  if (cursor.x > cursor.linebuffer->size) {
-    cursor.x = cursor.linebuffer->size;
-  }
-  cursor.linebuffer->dirty = 2;
+void index_all() {
+  while (!fmap.done) index_more();
 }
 
-// 不会读\n
-char *fgets(int fd, char *buf, int max) {
-  int i, cc;
-  char c;
+struct linebuffer *create_hole(int first, uint off, int nline) {
+  struct linebuffer *h = create_linebuffer();
+  free(h->buf);
+  h->buf = NULL;
+  h->first = first;
+  h->off = off;
+  h->nline = nline;
+  return h;
+}
 
-  for (i = 0; i + 1 < max;) {
-    cc = read(fd, &c, 1);
-    if (cc < 1) break;
-    if (c == '\n') break;
-    buf[i++] = c;
-  }
-  buf[i] = '\0';
-  return buf;
+// 在node之前插入lbp
+void hole_insert_before(struct linebuffer *node, struct linebuffer *lbp) {
+  struct linebuffer *prev = node->prev;
+  link_linebuffer(prev, lbp);
+  link_linebuffer(lbp, node);
+  index_insert(prev, lbp);
 }
 
-void save() {
+// 取出空洞h中的第r行(从0开始)作为真实的行并返回。h总是保留在r之后的部分，
+// 所以指向h的undo记录在拆分后仍然指向同一位置
+struct linebuffer *hole_split(struct linebuffer *h, int r) {
   struct linebuffer *lbp;
-  int fd;
+  uint off;
 
-  fd = open(outputfilename, O_CREATE | O_TRUNC | O_WRONLY);
+  off = r == 0 ? h->off : file_line_offset(h->first + r);
+  if (r > 0) {
+    index_reweight(h, -r);
+    hole_insert_before(h, create_hole(h->first, h->off, r));
+  }
 
-  if (fd < 0) {
-    exit(-1);
+  if (h->nline == 1 && h != fmap.rest) {
+    lbp = h;
+    lbp->buf = malloc(LINE_BUFFER_LENGTH);
+  } else {
+    lbp = create_linebuffer();
+    index_reweight(h, -1);
+    hole_insert_before(h, lbp);
+  }
+  reader_seek(&rd, fmap.fd, off);
+  memset(lbp->buf, '\0', LINE_BUFFER_LENGTH);
+  lbp->size = reader_line(&rd, lbp->buf);
+  if (lbp->size < 0) lbp->size = 0;
+  lbp->dirty = 1;
+  lbp->first = h->first + r;
+  lbp->off = off;
+  lbp->clean = 1;
+  fmap.nread++;
+
+  if (lbp != h) {
+    h->first += r + 1;
+    h->off = reader_tell(&rd);
   }
+  return lbp;
+}
 
-  lbp = linebuffer_head.next;
-  while (lbp != &linebuffer_tail) {
-    fprintf(fd, "%s\n", lbp->buf);
-    lbp = lbp->next;
+// 返回lbp的下一行，需要时从文件中读入
+struct linebuffer *line_next(struct linebuffer *lbp) {
+  struct linebuffer *n = lbp->next;
+
+  while (n->buf == NULL) {
+    if (n->nline > 0) return hole_split(n, 0);
+    // only fmap.rest can be empty
+    if (fmap.done) {
+      n = n->next;
+    } else {
+      index_more();
+    }
   }
+  return n;
+}
 
-  close(fd);
+struct linebuffer *line_prev(struct linebuffer *lbp) {
+  struct linebuffer *p = lbp->prev;
+
+  while (p->buf == NULL) {
+    if (p->nline > 0) return hole_split(p, p->nline - 1);
+    if (fmap.done) {
+      p = p->prev;
+    } else {
+      index_more();
+    }
+  }
+  return p;
 }
 
-void load() {
-  char buf[LINE_BUFFER_LENGTH];
+// text primitives: the only places that change line contents or links,
+// shared by the editing commands and by undo/redo
+void text_touch() {
+  modified = 1;
+  text_version++;
+}
 
-  struct linebuffer *lbp, *lbpnext;
+void text_insert(struct linebuffer *lbp, int x, char *s, int n) {
+  text_touch();
+  memmove(lbp->buf + x + n, lbp->buf + x, lbp->size - x + 1);
+  memmove(lbp->buf + x, s, n);
+  lbp->size += n;
+  lbp->dirty = 1;
+  lbp->clean = 0;
+}
 
-  int fd = open(inputfilename, O_RDONLY);
-  if (fd < 0) {
-    return;
-  }
+void text_delete(struct linebuffer *lbp, int x, int n) {
+  text_touch();
+  memmove(lbp->buf + x, lbp->buf + x + n, lbp->size - x - n + 1);
+  lbp->size -= n;
+  lbp->buf[lbp->size] = '\0';
+  lbp->dirty = 1;
+  lbp->clean = 0;
+}
 
-  lbp = &linebuffer_head;
-  fgets(fd, buf, sizeof(buf));
-  while (buf[0] != 0) {
-    lbpnext = create_linebuffer();
-    strcpy(lbpnext->buf, buf);
-    lbpnext->size = strlen(buf);
-    link_linebuffer(lbp, lbpnext);
-    lbp = lbpnext;
-    memset(buf, '\0', sizeof(buf));
-    fgets(fd, buf, sizeof(buf));
-  }
-  link_linebuffer(lbp, &linebuffer_tail);
+// 把lbp挂到prev之后
+void line_link(struct linebuffer *prev, struct linebuffer *lbp) {
+  text_touch();
+  link_linebuffer(lbp, prev->next);
+  link_linebuffer(prev, lbp);
+  lbp->dirty = 2;
+  index_insert(prev, lbp);
+}
 
-  cursor.linebuffer = linebuffer_head.next;
-  cursor.x = 0;
-  cursor.y = 1;
-  screen.upperline = linebuffer_head.next;
+void line_unlink(struct linebuffer *lbp) {
+  text_touch();
+  if (lbp == screen.upperline) {
+    screen.upperline = lbp->next;
+  }
+  link_linebuffer(lbp->prev, lbp->next);
+  lbp->prev->dirty = 2;
+  index_remove(lbp);
+}
 
-  close(fd);
-  is_change = 1;
+// 将lbp在x处断开，x之后的内容移到aux，aux挂到lbp之后
+void line_split(struct linebuffer *lbp, int x, struct linebuffer *aux) {
+  aux->size = lbp->size - x;
+  memmove(aux->buf, lbp->buf + x, aux->size);
+  aux->buf[aux->size] = '\0';
+  lbp->size = x;
+  memset(lbp->buf + x, '\0', LINE_BUFFER_LENGTH - x);
+  line_link(lbp, aux);
+  lbp->dirty = 2;
+  lbp->clean = 0;
 }
 
-void quit() { quit_flg = 1; }
+// 将aux接到lbp末尾并摘下aux，调用者保证长度不超过LINE_BUFFER_LENGTH
+void line_join(struct linebuffer *lbp, struct linebuffer *aux) {
+  merge_linebuffer(lbp, aux);
+  lbp->buf[lbp->size] = '\0';
+  line_unlink(aux);
+  lbp->dirty = 2;
+  lbp->clean = 0;
+}
 
-int ischaracter(char c) { return 0x20 <= c && c <= 0x7e; }
+// undo journal
+//  every edit is recorded as the primitive above that performed it, so
+//  undo/redo cost is proportional to the edit, never to the file.
+//  journal.applied splits the list: entries up to it are applied (undo
+//  stack), entries after it were undone (redo stack). Line nodes taken
+//  out of the text stay alive inside the entry that removed them.
+struct edit {
+  int type;
+  int lineno;               // line number of line (of aux for PUTLINE/DELLINE)
+  int x;
+  struct linebuffer *line;  // edited line, or the line aux hangs after
+  struct linebuffer *aux;   // line moved in or out by line edits
+  char *text;               // INSERT/DELETE payload
+  int len;
+  int cap;
+  struct edit *prev;
+  struct edit *next;
+};
 
-void find_string() {
-  if (find_str[0] == 0) {
-    return;
+struct journal {
+  struct edit *first;
+  struct edit *last;
+  struct edit *applied;  // newest applied edit, 0 if everything is undone
+  int bytes;
+  int seal;  // 1 stops the next edit from coalescing into the last one
+} journal;
+
+int edit_bytes(struct edit *e) {
+  int n = sizeof(struct edit) + e->cap;
+  if (e->aux != NULL) {
+    n += sizeof(struct linebuffer) + LINE_BUFFER_LENGTH;
   }
+  return n;
+}
 
-  struct linebuffer *lbp = cursor.linebuffer;
-  int i = cursor.x;
-  int j = 0;
-  int found = 0;
-  char *p = 0;
-  int find_str_length = strlen(find_str);
+void edit_free(struct edit *e, int applied) {
+  int owned;
 
-  while (lbp != &linebuffer_tail) {
-    p = cursor.linebuffer->buf;
-    while (i < cursor.linebuffer->size) {
-      if (p[i] == find_str[j]) {
-        i++;
-        j++;
-        if (j == find_str_length) {
-          found = 1;
-          break;
-        }
-      } else if (j != 0) {
-        j = 0;
-      } else {
-        i++;
-      }
-    }
-    if (found) break;
-    cursor_down();
-    lbp = lbp->next;
-    i = 0;
-    j = 0;
+  // aux is owned by the entry exactly when it is not linked into the text
+  if (applied) {
+    owned = e->type == EDIT_DELLINE || e->type == EDIT_JOIN;
+  } else {
+    owned = e->type == EDIT_PUTLINE || e->type == EDIT_SPLIT;
+  }
+  if (owned) {
+    free(e->aux->buf);
+    free(e->aux);
   }
+  if (e->text != NULL) {
+    free(e->text);
+  }
+  free(e);
+}
 
-  if (found) {
-    cursor.x = i - find_str_length;
+void journal_unlink(struct edit *e) {
+  if (e->prev != NULL) {
+    e->prev->next = e->next;
+  } else {
+    journal.first = e->next;
+  }
+  if (e->next != NULL) {
+    e->next->prev = e->prev;
   } else {
-    error("\033[31mHit bottom. Can't find string\e[0m");
+    journal.last = e->prev;
   }
+  journal.bytes -= edit_bytes(e);
 }
 
-void reverse_find_string() {
-  if (find_str[0] == 0) {
-    return;
-  }
-  if (cursor.x == 0) {
-    cursor_up();
+void journal_clear() {
+  struct edit *e;
+  int applied = journal.applied != NULL;
+
+  while ((e = journal.first) != NULL) {
+    journal_unlink(e);
+    if (e == journal.applied) {
+      edit_free(e, applied);
+      applied = 0;
+    } else {
+      edit_free(e, applied);
+    }
   }
-  int find_str_length = strlen(find_str);
-  struct linebuffer *lbp = cursor.linebuffer;
-  int i = cursor.x;
-  int j = find_str_length - 1;
-  int found = 0;
-  char *p = 0;
+  journal.applied = NULL;
+  journal.seal = 1;
+}
 
-  if (cursor.x == cursor.linebuffer->size) {
-    i--;
+// drop the oldest edits until the journal fits its budget again
+void journal_trim() {
+  struct edit *e;
+
+  while (journal.bytes > UNDO_BUDGET && journal.first != journal.applied) {
+    e = journal.first;
+    journal_unlink(e);
+    edit_free(e, 1);
   }
+}
 
-  while (lbp != &linebuffer_head) {
-    p = cursor.linebuffer->buf;
-    while (i >= 0) {
-      if (p[i] == find_str[j]) {
-        i--;
-        j--;
-        if (j == -1) {
-          found = 1;
-          break;
-        }
-      } else if (j != find_str_length - 1) {
-        j = find_str_length - 1;
-      } else {
-        i--;
-      }
-    }
-    if (found) break;
-    cursor_up();
-    lbp = lbp->prev;
-    i = cursor.linebuffer->size - 1;
-    j = find_str_length - 1;
+// 添加新的编辑记录，同时丢弃所有可重做的记录
+struct edit *journal_push(int type, struct linebuffer *line, int lineno,
+                          int x, struct linebuffer *aux) {
+  struct edit *e, *next;
+
+  e = journal.applied != NULL ? journal.applied->next : journal.first;
+  while (e != NULL) {
+    next = e->next;
+    journal_unlink(e);
+    edit_free(e, 0);
+    e = next;
   }
 
-  if (found) {
-    cursor.x = i + 1;
+  e = malloc(sizeof(struct edit));
+  memset(e, 0, sizeof(struct edit));
+  e->type = type;
+  e->line = line;
+  e->lineno = lineno;
+  e->x = x;
+  e->aux = aux;
+
+  e->prev = journal.last;
+  if (journal.last != NULL) {
+    journal.last->next = e;
   } else {
-    error("\033[31mHit top. Can't find string\e[0m");
+    journal.first = e;
   }
+  journal.last = e;
+  journal.applied = e;
+  journal.bytes += edit_bytes(e);
+  journal.seal = 0;
+  return e;
 }
 
-void input_command(char c) {
-  switch (c) {
-    case KEYCODE_ESC:
-      statusbar_command_end();
-      return;
+// 在e->text的pos处插入n个字符，空间不足时倍增
+void edit_text_insert(struct edit *e, int pos, char *s, int n) {
+  char *text;
+  int cap;
+
+  if (e->len + n > e->cap) {
+    cap = e->cap ? e->cap : 8;
+    while (cap < e->len + n) cap *= 2;
+    text = malloc(cap);
+    if (e->text != NULL) {
+      memmove(text, e->text, e->len);
+      free(e->text);
+    }
+    journal.bytes += cap - e->cap;
+    e->text = text;
+    e->cap = cap;
+  }
+  memmove(e->text + pos + n, e->text + pos, e->len - pos);
+  memmove(e->text + pos, s, n);
+  e->len += n;
+}
+
+int journal_can_coalesce(int type, struct linebuffer *line) {
+  struct edit *e = journal.applied;
+  return !journal.seal && e != NULL && e == journal.last &&
+         e->type == type && e->line == line;
+}
+
+void journal_record_insert(struct linebuffer *line, int lineno, int x,
+                           char c) {
+  struct edit *e = journal.applied;
+
+  if (journal_can_coalesce(EDIT_INSERT, line) && e->x + e->len == x) {
+    edit_text_insert(e, e->len, &c, 1);
+  } else {
+    e = journal_push(EDIT_INSERT, line, lineno, x, NULL);
+    edit_text_insert(e, 0, &c, 1);
+  }
+  journal_trim();
+}
+
+// 必须在删除之前调用，以便保存被删除的内容
+void journal_record_delete(struct linebuffer *line, int lineno, int x,
+                           int n) {
+  struct edit *e = journal.applied;
+
+  if (journal_can_coalesce(EDIT_DELETE, line) && e->x == x) {
+    // x repeated at the same column
+    edit_text_insert(e, e->len, line->buf + x, n);
+  } else if (journal_can_coalesce(EDIT_DELETE, line) && e->x == x + n) {
+    // backspace walking left
+    edit_text_insert(e, 0, line->buf + x, n);
+    e->x = x;
+  } else {
+    e = journal_push(EDIT_DELETE, line, lineno, x, NULL);
+    edit_text_insert(e, 0, line->buf + x, n);
+  }
+  journal_trim();
+}
+
+void journal_record_line(int type, struct linebuffer *line, int lineno, int x,
+                         struct linebuffer *aux) {
+  journal_push(type, line, lineno, x, aux);
+  journal_trim();
+}
+
+// 光标跳到lbp的x处，尽量保持光标在屏幕中的行不变
+void cursor_jump(struct linebuffer *lbp, int lineno, int x) {
+  int row;
+
+  if (lbp == &linebuffer_head || lbp->buf == NULL) {
+    // the anchor of a line edit: head or a hole, use the line itself
+    if (lineno < 1) lineno = 1;
+    lbp = line_at(lineno);
+  }
+  cursor.linebuffer = lbp;
+  cursor.y = lineno;
+  cursor.x = x > lbp->size ? lbp->size : x;
+
+  row = cursor.y - screen.line;
+  if (row < 0) row = 0;
+  if (row > screen.height - 1) row = screen.height - 1;
+  while (row-- > 0 && lbp->prev != &linebuffer_head) {
+    lbp = line_prev(lbp);
+    lineno--;
+  }
+  if (lbp != screen.upperline) {
+    screen.upperline = lbp;
+    screen.line = lineno;
+    is_change = 1;
+  }
+}
+
+void undo() {
+  struct edit *e = journal.applied;
+
+  if (e == NULL) {
+    error("Already at oldest change");
+    return;
+  }
+  switch (e->type) {
+    case EDIT_INSERT:
+      text_delete(e->line, e->x, e->len);
+      cursor_jump(e->line, e->lineno, e->x);
+      break;
+    case EDIT_DELETE:
+      text_insert(e->line, e->x, e->text, e->len);
+      cursor_jump(e->line, e->lineno, e->x);
+      break;
+    case EDIT_SPLIT:
+      line_join(e->line, e->aux);
+      cursor_jump(e->line, e->lineno, e->x);
+      break;
+    case EDIT_JOIN:
+      line_split(e->line, e->x, e->aux);
+      cursor_jump(e->aux, e->lineno + 1, 0);
+      break;
+    case EDIT_PUTLINE:
+      line_unlink(e->aux);
+      cursor_jump(e->line, e->lineno - 1, 0);
+      break;
+    case EDIT_DELLINE:
+      line_link(e->line, e->aux);
+      cursor_jump(e->aux, e->lineno, 0);
+      break;
+  }
+  journal.applied = e->prev;
+  journal.seal = 1;
+  is_change = 1;
+}
+
+void redo() {
+  struct edit *e;
+
+  e = journal.applied != NULL ? journal.applied->next : journal.first;
+  if (e == NULL) {
+    error("Already at newest change");
+    return;
+  }
+  switch (e->type) {
+    case EDIT_INSERT:
+      text_insert(e->line, e->x, e->text, e->len);
+      cursor_jump(e->line, e->lineno, e->x);
+      break;
+    case EDIT_DELETE:
+      text_delete(e->line, e->x, e->len);
+      cursor_jump(e->line, e->lineno, e->x);
+      break;
+    case EDIT_SPLIT:
+      line_split(e->line, e->x, e->aux);
+      cursor_jump(e->aux, e->lineno + 1, 0);
+      break;
+    case EDIT_JOIN:
+      line_join(e->line, e->aux);
+      cursor_jump(e->line, e->lineno, e->x);
+      break;
+    case EDIT_PUTLINE:
+      line_link(e->line, e->aux);
+      cursor_jump(e->aux, e->lineno, 0);
+      break;
+    case EDIT_DELLINE:
+      line_unlink(e->aux);
+      cursor_jump(e->line, e->lineno - 1, 0);
+      break;
+  }
+  journal.applied = e;
+  journal.seal = 1;
+  is_change = 1;
+}
+
+// mode
+void mode_change(int m) {
+  mode = m;
+  journal.seal = 1;
+  switch (m) {
+    case MODE_INSERT:
+      set_statusbar_mode("-- INSERT --");
+      return;
+    case MODE_NORMAL:
+      set_statusbar_mode("-- NORMAL --");
+      return;
+  }
+}
+
+void change_hightlight() {
+  if (is_hightlight) {
+    is_hightlight = 0;
+    is_change = 1;
+    error("syntax hightlight on");
+    return;
+  }
+  is_hightlight = 1;
+  is_change = 1;
+  error("syntax hightlight off");
+}
+
+void delete_normal() {
+  if (cursor.x == cursor.linebuffer->size) return;
+  // is_change = 1;
+  journal_record_delete(cursor.linebuffer, cursor.y, cursor.x, 1);
+  text_delete(cursor.linebuffer, cursor.x, 1);
+
+  if (cursor.x > cursor.linebuffer->size) {
+    cursor.x = cursor.linebuffer->size;
+  }
+}
+
+struct linebuffer *copy_linebuffer(struct linebuffer *src) {
+  struct linebuffer *lbp = create_linebuffer();
+  memcpy(lbp->buf, src->buf, LINE_BUFFER_LENGTH);
+  lbp->size = src->size;
+  return lbp;
+}
+
+void deleteline_normal() {
+  struct linebuffer *p, *n;
+
+  p = cursor.linebuffer->prev;
+  n = line_next(cursor.linebuffer);
+
+  // is_change = 1;
+
+  // 保存删除的行以便等会复制时恢复，原行归undo记录所有
+  if (last_delete_line != NULL) {
+    free(last_delete_line->buf);
+    free(last_delete_line);
+  }
+  last_delete_line = copy_linebuffer(cursor.linebuffer);
+
+  if (p == &linebuffer_head && n == &linebuffer_tail) {
+    if (cursor.linebuffer->size > 0) {
+      journal_record_delete(cursor.linebuffer, 1, 0, cursor.linebuffer->size);
+      text_delete(cursor.linebuffer, 0, cursor.linebuffer->size);
+    }
+    cursor.x = 0;
+    cursor.y = 1;
+    cursor.linebuffer->dirty = 2;
+    return;
+  }
+
+  journal_record_line(EDIT_DELLINE, p, cursor.y, 0, cursor.linebuffer);
+  line_unlink(cursor.linebuffer);
+
+  cursor.linebuffer = n;
+  cursor_up();
+  if (cursor.x > cursor.linebuffer->size) {
+    cursor.x = cursor.linebuffer->size;
+  }
+  cursor.linebuffer->dirty = 2;
+}
+
+// 写文件的缓冲
+struct writer {
+  int fd;
+  int len;
+  int err;  // a write came up short, e.g. the disk is full
+  char blk[FILE_BLOCK];
+} wr;
+
+void writer_flush() {
+  if (wr.len > 0 && write(wr.fd, wr.blk, wr.len) != wr.len) wr.err = 1;
+  wr.len = 0;
+}
+
+void writer_put(char *s, int n) {
+  int k;
+
+  while (n > 0) {
+    k = FILE_BLOCK - wr.len;
+    if (k > n) k = n;
+    memmove(wr.blk + wr.len, s, k);
+    wr.len += k;
+    s += k;
+    n -= k;
+    if (wr.len == FILE_BLOCK) writer_flush();
+  }
+}
+
+// 把空洞h代表的文件内容原样复制到输出，返回最后一个字节
+int save_hole(struct linebuffer *h) {
+  uint end;
+  int n, last = '\n';
+
+  end = file_line_offset(h->first + h->nline);
+  reader_seek(&rd, fmap.fd, h->off);
+  while (reader_tell(&rd) < end && reader_getc(&rd) >= 0) {
+    rd.pos--;
+    n = rd.len - rd.pos;
+    if (n > end - reader_tell(&rd)) n = end - reader_tell(&rd);
+    writer_put(rd.blk + rd.pos, n);
+    rd.pos += n;
+    last = rd.blk[rd.pos - 1];
+  }
+  return last;
+}
+
+// 修改过的行从内存写出，其余部分从原文件复制
+void save() {
+  struct linebuffer *lbp;
+  int fd, replace;
+
+  index_all();
+  // 覆盖任何buffer正在读的文件时先写到临时文件，写完再换上去：
+  // 先unlink目标再link，不是原子的rename
+  replace = buffer_reads(outputfilename);
+  fd = open(replace ? SAVE_TMPFILE : outputfilename,
+            O_CREATE | O_TRUNC | O_WRONLY);
+
+  if (fd < 0) {
+    command_message("Can't open file for writing");
+    return;
+  }
+
+  wr.fd = fd;
+  wr.len = 0;
+  wr.err = 0;
+  lbp = linebuffer_head.next;
+  while (lbp != &linebuffer_tail) {
+    if (lbp->buf != NULL) {
+      writer_put(lbp->buf, lbp->size);
+      writer_put("\n", 1);
+    } else if (lbp->nline > 0 && save_hole(lbp) != '\n' &&
+               lbp->next != &linebuffer_tail) {
+      // the file did not end with a newline but lines were added after it
+      writer_put("\n", 1);
+    }
+    lbp = lbp->next;
+  }
+  writer_flush();
+  close(fd);
+
+  if (wr.err) {
+    // the target is untouched unless it was written directly
+    if (replace) unlink(SAVE_TMPFILE);
+    command_message("Write failed, file not saved");
+    return;
+  }
+  if (replace) {
+    unlink(outputfilename);
+    if (link(SAVE_TMPFILE, outputfilename) < 0) {
+      // keep the only complete copy
+      command_message("Can't replace file, text saved in " SAVE_TMPFILE);
+      return;
+    }
+    unlink(SAVE_TMPFILE);
+  }
+  if (strcmp(outputfilename, inputfilename) == 0) {
+    modified = 0;
+  }
+}
+
+// 只读入填满屏幕所需的部分，其余部分在显示或编辑时再读
+void load() {
+  int fd = open(inputfilename, O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+
+  if (fmap.fd >= 0) {
+    close(fmap.fd);
+  }
+  if (fmap.mark != NULL) {
+    free(fmap.mark);
+  }
+  memset(&fmap, 0, sizeof(fmap));
+  fmap.fd = fd;
+  safestrcpy(fmap.name, inputfilename, sizeof(fmap.name));
+  reader_seek(&fmap.idx, fd, 0);
+
+  line_root = NULL;
+  fmap.rest = create_hole(0, 0, 0);
+  link_linebuffer(&linebuffer_head, fmap.rest);
+  link_linebuffer(fmap.rest, &linebuffer_tail);
+  index_insert(&linebuffer_head, fmap.rest);
+  index_until(SCREEN_HEIGHT);
+  if (line_count() == 0) {
+    hole_insert_before(fmap.rest, create_linebuffer());
+  }
+
+  cursor.linebuffer = line_next(&linebuffer_head);
+  cursor.x = 0;
+  cursor.y = 1;
+  screen.upperline = cursor.linebuffer;
+  screen.line = 1;
+
+  journal_clear();
+  is_change = 1;
+}
+
+void quit() { quit_flg = 1; }
+
+// buffers
+//  every file being edited has a buffer. Only the current one, curbuf, is
+//  linked between linebuffer_head and linebuffer_tail and lives in the
+//  globals (line_root, journal, fmap, ...); the others are parked in their
+//  struct buffer, so switching is a few struct copies whatever the size.
+//  Cursor and screen belong to the current window, see struct window.
+struct buffer {
+  int id;
+  char name[64];
+  struct linebuffer *first;  // lines, while parked
+  struct linebuffer *last;
+  struct linebuffer *root;
+  struct journal journal;
+  struct filemap fmap;
+  int modified;
+  int version;
+  struct view view;  // where the cursor was when the buffer was left
+  struct buffer *next;
+};
+
+struct buffer *buffers;
+struct buffer *curbuf;
+int buffer_ids;
+
+void buffer_park(struct buffer *b) {
+  b->first = linebuffer_head.next;
+  b->last = linebuffer_tail.prev;
+  b->root = line_root;
+  b->journal = journal;
+  b->fmap = fmap;
+  b->modified = modified;
+  b->version = text_version;
+  safestrcpy(b->name, inputfilename, sizeof(b->name));
+}
+
+// 把b的文字换进全局变量，光标和屏幕不变
+void buffer_activate(struct buffer *b) {
+  if (b == curbuf) return;
+  buffer_park(curbuf);
+  link_linebuffer(&linebuffer_head, b->first);
+  link_linebuffer(b->last, &linebuffer_tail);
+  line_root = b->root;
+  journal = b->journal;
+  fmap = b->fmap;
+  modified = b->modified;
+  text_version = b->version;
+  strcpy(inputfilename, b->name);
+  curbuf = b;
+}
+
+void view_save(struct view *v) {
+  v->x = cursor.x;
+  v->y = cursor.y;
+  v->top = screen.line;
+}
+
+void view_restore(struct view *v) {
+  int n;
+
+  index_until(v->y > v->top ? v->y : v->top);
+  n = line_count();
+  screen.line = v->top < 1 ? 1 : v->top > n ? n : v->top;
+  screen.upperline = line_at(screen.line);
+  cursor.y = v->y < 1 ? 1 : v->y > n ? n : v->y;
+  cursor_jump(line_at(cursor.y), cursor.y, v->x);
+  is_change = 1;
+}
+
+// 新建一个buffer并设为当前buffer，name非空时读入该文件
+struct buffer *buffer_open(char *name) {
+  struct buffer *b, **pp;
+  struct linebuffer *lbp;
+
+  b = malloc(sizeof(struct buffer));
+  memset(b, 0, sizeof(struct buffer));
+  b->id = ++buffer_ids;
+  for (pp = &buffers; *pp != NULL; pp = &(*pp)->next)
+    ;
+  *pp = b;
+
+  if (curbuf != NULL) {
+    buffer_park(curbuf);
+  }
+  curbuf = b;
+  line_root = NULL;
+  link_linebuffer(&linebuffer_head, &linebuffer_tail);
+  memset(&journal, 0, sizeof(journal));
+  memset(&fmap, 0, sizeof(fmap));
+  fmap.fd = -1;
+  modified = 0;
+  text_version = 0;
+  safestrcpy(inputfilename, name, sizeof(inputfilename));
+
+  if (name[0] != '\0') {
+    load();
+  }
+  if (linebuffer_head.next == &linebuffer_tail) {
+    // new file
+    lbp = create_linebuffer();
+    link_linebuffer(&linebuffer_head, lbp);
+    link_linebuffer(lbp, &linebuffer_tail);
+    index_insert(&linebuffer_head, lbp);
+    cursor_init(lbp);
+    screen_init();
+  }
+  is_change = 1;
+  return b;
+}
+
+// 在当前窗口中显示b
+void buffer_switch(struct buffer *b) {
+  if (b == curbuf) return;
+  view_save(&curbuf->view);
+  buffer_activate(b);
+  windows[curwin].buf = b;
+  view_restore(&b->view);
+}
+
+// :e，文件已经打开时切换过去而不重新读入
+void buffer_edit(char *name) {
+  struct buffer *b;
+
+  if (strcmp(name, inputfilename) == 0) return;
+  for (b = buffers; b != NULL; b = b->next) {
+    if (b != curbuf && strcmp(name, b->name) == 0) {
+      buffer_switch(b);
+      return;
+    }
+  }
+  view_save(&curbuf->view);
+  windows[curwin].buf = buffer_open(name);
+  cursor_jump(cursor.linebuffer, cursor.y, cursor.x);
+}
+
+// :bn, :bp
+void buffer_next(int dir) {
+  struct buffer *b, *prev = NULL;
+
+  if (dir > 0) {
+    b = curbuf->next != NULL ? curbuf->next : buffers;
+  } else {
+    for (b = buffers; b != curbuf; b = b->next) prev = b;
+    if (prev == NULL) {
+      for (prev = buffers; prev->next != NULL; prev = prev->next)
+        ;
+    }
+    b = prev;
+  }
+  buffer_switch(b);
+}
+
+// :b N
+void buffer_goto(int id) {
+  struct buffer *b;
+
+  for (b = buffers; b != NULL; b = b->next) {
+    if (b->id == id) {
+      buffer_switch(b);
+      return;
+    }
+  }
+  command_message("No such buffer");
+}
+
+char *buffer_name(struct buffer *b) {
+  char *name = b == curbuf ? inputfilename : b->name;
+  return name[0] != '\0' ? name : "[No Name]";
+}
+
+int buffer_modified(struct buffer *b) {
+  return b == curbuf ? modified : b->modified;
+}
+
+// 是否有buffer的空洞还在从文件name读
+//  compared by dev and inode, so ./name, other paths and hard links to
+//  the file count too
+int buffer_reads(char *name) {
+  struct buffer *b;
+  struct filemap *m;
+  struct stat st, fst;
+
+  if (stat(name, &st) < 0) return 0;
+  for (b = buffers; b != NULL; b = b->next) {
+    m = b == curbuf ? &fmap : &b->fmap;
+    if (m->fd >= 0 && fstat(m->fd, &fst) == 0 && fst.dev == st.dev &&
+        fst.ino == st.ino)
+      return 1;
+  }
+  return 0;
+}
+
+// :ls，每个buffer显示为 编号[%当前][+已修改]文件名
+void buffer_list() {
+  char msg[STATUSBAR_MESSAGE_LENGTH];
+  char item[STATUSBAR_MESSAGE_LENGTH + 16];
+  struct buffer *b;
+  char *p;
+  int n = 0;
+
+  msg[0] = '\0';
+  for (b = buffers; b != NULL; b = b->next) {
+    p = putint(item, b->id);
+    if (b == curbuf) *p++ = '%';
+    if (buffer_modified(b)) *p++ = '+';
+    *p++ = ' ';
+    safestrcpy(p, buffer_name(b), STATUSBAR_MESSAGE_LENGTH);
+    if (n + strlen(item) + 2 >= STATUSBAR_MESSAGE_LENGTH) break;
+    if (n > 0) {
+      strcpy(msg + n, "  ");
+      n += 2;
+    }
+    strcpy(msg + n, item);
+    n += strlen(item);
+  }
+  command_message(msg);
+}
+
+// 释放当前buffer的文字
+void buffer_free_text() {
+  struct linebuffer *lbp, *lbptmp;
+
+  lbp = (&linebuffer_tail)->prev;
+  while (lbp != &linebuffer_head) {
+    lbptmp = lbp;
+    lbp = lbp->prev;
+    if (lbptmp->buf != NULL) free(lbptmp->buf);
+    free(lbptmp);
+  }
+  journal_clear();
+  if (fmap.fd >= 0) {
+    close(fmap.fd);
+  }
+  if (fmap.mark != NULL) {
+    free(fmap.mark);
+  }
+}
+
+// 第n行是否在显示当前buffer的某个窗口附近(上下各留一屏)
+int line_near(int n) {
+  int i, top;
+
+  for (i = 0; i < nwindow; i++) {
+    if (windows[i].buf != curbuf) continue;
+    top = i == curwin ? screen.line : windows[i].view.top;
+    if (n >= top - SCREEN_HEIGHT && n < top + windows[i].height + SCREEN_HEIGHT)
+      return 1;
+  }
+  return 0;
+}
+
+// 把离所有窗口都远、未修改过的行放回空洞，读入的行数因此不随文件增长
+//  lines referenced by the journal are kept: undo/redo holds their
+//  pointers. The list is walked backwards so that a run of evicted lines
+//  is prepended into the hole after it one by one; prepending keeps the
+//  end of that hole, which is all a record pointing at it relies on.
+void line_evict() {
+  struct linebuffer *lbp, *prev, *h;
+  struct edit *e;
+  int n;
+
+  if (fmap.nread < LINE_CACHE) return;
+  fmap.nread = 0;
+
+  // pin the lines the journal points at
+  for (e = journal.first; e != NULL; e = e->next) {
+    if (e->line != NULL && e->line->clean) e->line->clean = 2;
+    if (e->aux != NULL && e->aux->clean) e->aux->clean = 2;
+  }
+
+  n = line_count();
+  for (lbp = linebuffer_tail.prev; lbp != &linebuffer_head; lbp = prev) {
+    prev = lbp->prev;
+    n -= lbp->nline;
+    if (lbp->clean != 1 || lbp == cursor.linebuffer ||
+        lbp == screen.upperline || line_near(n + 1))
+      continue;
+
+    h = lbp->next;
+    if (h != &linebuffer_tail && h->buf == NULL &&
+        h->first == lbp->first + 1) {
+      h->first = lbp->first;
+      h->off = lbp->off;
+      index_remove(lbp);
+      link_linebuffer(prev, h);
+      index_reweight(h, 1);
+      free(lbp->buf);
+      free(lbp);
+    } else {
+      free(lbp->buf);
+      lbp->buf = NULL;
+      lbp->clean = 0;
+    }
+  }
+
+  for (e = journal.first; e != NULL; e = e->next) {
+    if (e->line != NULL && e->line->clean == 2) e->line->clean = 1;
+    if (e->aux != NULL && e->aux->clean == 2) e->aux->clean = 1;
+  }
+}
+
+// windows
+//  the SCREEN_HEIGHT rows above the status bar are shared by nwindow
+//  windows stacked top to bottom. The current window's cursor and screen
+//  are the globals, the others keep a struct view. When there is more
+//  than one window each is followed by a line with its file name.
+void window_layout() {
+  int i, h, row = 1;
+  int split = nwindow > 1;
+  int avail = SCREEN_HEIGHT - (split ? nwindow : 0);
+
+  for (i = 0; i < nwindow; i++) {
+    h = avail / nwindow;
+    if (i == nwindow - 1) h = avail - h * (nwindow - 1);
+    windows[i].row = row;
+    windows[i].height = h;
+    row += h + split;
+  }
+  screen.row = windows[curwin].row;
+  screen.height = windows[curwin].height;
+  is_change = 1;
+}
+
+// 切换到第i个窗口，不保存当前窗口的位置
+void window_load(int i) {
+  curwin = i;
+  buffer_activate(windows[i].buf);
+  window_layout();
+  view_restore(&windows[i].view);
+}
+
+void window_enter(int i) {
+  view_save(&windows[curwin].view);
+  view_save(&curbuf->view);
+  window_load(i);
+}
+
+// :sp [file]，新窗口在当前窗口上方
+void window_split(char *name) {
+  if (nwindow == MAX_WINDOWS) {
+    command_message("Not enough room");
+    return;
+  }
+  memmove(&windows[curwin + 1], &windows[curwin],
+          (nwindow - curwin) * sizeof(struct window));
+  nwindow++;
+  view_save(&windows[curwin + 1].view);
+  window_layout();
+  cursor_jump(cursor.linebuffer, cursor.y, cursor.x);
+  if (name[0] != '\0') {
+    buffer_edit(name);
+  }
+}
+
+// :q，关闭最后一个窗口时退出
+void window_close() {
+  if (nwindow == 1) {
+    quit();
+    return;
+  }
+  view_save(&curbuf->view);
+  memmove(&windows[curwin], &windows[curwin + 1],
+          (nwindow - curwin - 1) * sizeof(struct window));
+  nwindow--;
+  window_load(curwin < nwindow ? curwin : nwindow - 1);
+}
+
+void window_status(int i) {
+  struct window *w = &windows[i];
+
+  term_cursor_location(0, w->row + w->height);
+  printf("\033[2K%s%s%s%s", i == curwin ? "\033[1;7m" : "\033[7m",
+         buffer_name(w->buf), buffer_modified(w->buf) ? " [+]" : "",
+         COLOR_clear);
+}
+
+// 画第i个窗口。其他窗口在full为0时只有在显示同一个buffer且文字变了时才重画
+void window_display(int i, int full) {
+  struct window *w = &windows[i];
+  struct buffer *b = curbuf;
+  int top;
+
+  if (i == curwin) {
+    display_lines(screen.upperline, screen.row, screen.height, full);
+  } else if (full || (w->buf == curbuf && w->version != text_version)) {
+    buffer_activate(w->buf);
+    index_until(w->view.top + w->height);
+    top = w->view.top < 1 ? 1 : w->view.top;
+    if (top > line_count()) top = line_count();
+    display_lines(line_at(top), w->row, w->height, 1);
+    buffer_activate(b);
+  }
+  w->version = text_version;
+  if (nwindow > 1) {
+    window_status(i);
+  }
+}
+
+int ischaracter(char c) { return 0x20 <= c && c <= 0x7e; }
+
+// search
+//  patterns without regex metacharacters are matched literally with
+//  Boyer-Moore-Horspool, the rest go through re.c. Lines are scanned
+//  through the list directly and the cursor only moves to the result.
+struct search {
+  char pattern[FIND_STR_LENGTH + 1];
+  int len;
+  int regex;
+  re_t re;
+  uchar skip[256];   // shift by last byte of the window, forward
+  uchar rskip[256];  // shift by first byte of the window, backward
+} search;
+
+int isregexmeta(char c) {
+  return c == '\\' || c == '.' || c == '^' || c == '$' || c == '*' ||
+         c == '+' || c == '?' || c == '[' || c == '(' || c == '|';
+}
+
+// 编译find_str，查找表只在find_str改变时重建
+void search_begin() {
+  int i, m;
+
+  if (strcmp(search.pattern, find_str) != 0) {
+    strcpy(search.pattern, find_str);
+    m = search.len = strlen(find_str);
+    search.regex = 0;
+    for (i = 0; i < m; i++) {
+      if (isregexmeta(find_str[i])) search.regex = 1;
+    }
+
+    for (i = 0; i < 256; i++) {
+      search.skip[i] = m;
+      search.rskip[i] = m;
+    }
+    for (i = 0; i < m - 1; i++) {
+      search.skip[(uchar)find_str[i]] = m - 1 - i;
+    }
+    for (i = m - 1; i > 0; i--) {
+      search.rskip[(uchar)find_str[i]] = i;
+    }
+
+    re_free(search.re);
+    search.re = search.regex ? re_compile_into(search.pattern, NULL) : NULL;
+  }
+}
+
+// 返回lbp中从from开始的第一个匹配位置，没有则返回-1
+int search_line(struct linebuffer *lbp, int from) {
+  char *p = lbp->buf;
+  int i, m, len, idx;
+
+  if (from > lbp->size) {
+    return -1;
+  }
+  if (search.regex) {
+    if (search.re == NULL) {
+      return -1;
+    }
+    // '^' only matches at the line start, wherever from is
+    idx = re_matchfrom(search.re, p, from, &len);
+    return idx < 0 ? -1 : idx;
+  }
+
+  m = search.len;
+  i = from;
+  while (i <= lbp->size - m) {
+    if (p[i + m - 1] == search.pattern[m - 1] &&
+        memcmp(p + i, search.pattern, m - 1) == 0) {
+      return i;
+    }
+    i += search.skip[(uchar)p[i + m - 1]];
+  }
+  return -1;
+}
+
+// 返回lbp中起始位置小于before的最后一个匹配位置，没有则返回-1
+int search_line_reverse(struct linebuffer *lbp, int before) {
+  char *p = lbp->buf;
+  int i, m, idx, pos;
+
+  if (search.regex) {
+    pos = -1;
+    i = 0;
+    while (i < before && (idx = search_line(lbp, i)) >= 0 && idx < before) {
+      pos = idx;
+      i = idx + 1;
+    }
+    return pos;
+  }
+
+  m = search.len;
+  i = lbp->size - m;
+  if (i > before - 1) i = before - 1;
+  while (i >= 0) {
+    if (p[i] == search.pattern[0] &&
+        memcmp(p + i + 1, search.pattern + 1, m - 1) == 0) {
+      return i;
+    }
+    i -= search.rskip[(uchar)p[i]];
+  }
+  return -1;
+}
+
+char scratch_buf[LINE_BUFFER_LENGTH];
+struct linebuffer scratch = {scratch_buf};
+
+// 在空洞h代表的文件内容中查找而不读入整个空洞，返回匹配行在h中的序号，
+// *col为匹配位置；reverse为1时返回最后一个匹配
+int search_hole(struct linebuffer *h, int reverse, int *col) {
+  int k, idx, found = -1;
+
+  reader_seek(&rd, fmap.fd, h->off);
+  for (k = 0; k < h->nline; k++) {
+    scratch.size = reader_line(&rd, scratch.buf);
+    if (scratch.size < 0) break;
+    idx = search_line(&scratch, 0);
+    if (idx < 0) continue;
+    found = k;
+    if (!reverse) {
+      *col = idx;
+      break;
+    }
+    *col = search_line_reverse(&scratch, scratch.size + 1);
+  }
+  return found;
+}
+
+void find_string() {
+  struct linebuffer *lbp = cursor.linebuffer;
+  int lineno = cursor.y;
+  int wrapped = 0;
+  int idx, r;
+
+  if (find_str[0] == 0) {
+    return;
+  }
+  search_begin();
+  index_all();
+
+  idx = search_line(lbp, cursor.x + 1);
+  while (idx < 0) {
+    lbp = lbp->next;
+    lineno++;
+    if (lbp == &linebuffer_tail) {
+      lbp = linebuffer_head.next;
+      lineno = 1;
+      wrapped = 1;
+    }
+    if (lbp->buf == NULL) {
+      if ((r = search_hole(lbp, 0, &idx)) < 0) {
+        lineno += lbp->nline - 1;
+        continue;
+      }
+      lbp = hole_split(lbp, r);
+      lineno += r;
+      break;
+    }
+    idx = search_line(lbp, 0);
+    if (lbp == cursor.linebuffer) break;
+  }
+
+  if (idx < 0) {
+    error("\033[31mPattern not found\e[0m");
+    return;
+  }
+  if (wrapped) {
+    error("search hit BOTTOM, continuing at TOP");
+  }
+  cursor_jump(lbp, lineno, idx);
+}
+
+void reverse_find_string() {
+  struct linebuffer *lbp = cursor.linebuffer;
+  int lineno = cursor.y;
+  int wrapped = 0;
+  int idx, r;
+
+  if (find_str[0] == 0) {
+    return;
+  }
+  search_begin();
+  index_all();
+
+  idx = search_line_reverse(lbp, cursor.x);
+  while (idx < 0) {
+    lbp = lbp->prev;
+    lineno--;
+    if (lbp == &linebuffer_head) {
+      lbp = linebuffer_tail.prev;
+      lineno = line_count();
+      wrapped = 1;
+    }
+    if (lbp->buf == NULL) {
+      if ((r = search_hole(lbp, 1, &idx)) < 0) {
+        lineno -= lbp->nline - 1;
+        continue;
+      }
+      lineno -= lbp->nline - 1 - r;
+      lbp = hole_split(lbp, r);
+      break;
+    }
+    idx = search_line_reverse(lbp, lbp->size + 1);
+    if (lbp == cursor.linebuffer) break;
+  }
+
+  if (idx < 0) {
+    error("\033[31mPattern not found\e[0m");
+    return;
+  }
+  if (wrapped) {
+    error("search hit TOP, continuing at BOTTOM");
+  }
+  cursor_jump(lbp, lineno, idx);
+}
+
+// navigation
+void goto_line(int n) {
+  index_until(n);
+  if (n < 1) n = 1;
+  if (n > line_count()) n = line_count();
+  cursor_jump(line_at(n), n, cursor.x);
+}
+
+// 屏幕顶端移到第top行，光标移到第lineno行，两者都限制在屏幕和文件范围内
+void screen_scroll(int top, int lineno) {
+  index_until(top + screen.height);
+  if (top > line_count()) top = line_count();
+  if (top < 1) top = 1;
+  if (lineno > top + screen.height - 1) lineno = top + screen.height - 1;
+  if (lineno > line_count()) lineno = line_count();
+  if (lineno < top) lineno = top;
+
+  screen.upperline = line_at(top);
+  screen.line = top;
+  cursor.linebuffer = line_at(lineno);
+  cursor.y = lineno;
+  if (cursor.x > cursor.linebuffer->size) cursor.x = cursor.linebuffer->size;
+  is_change = 1;
+}
+
+// 翻页时保留两行，窗口太矮时至少翻一行
+int page_step() { return screen.height > 3 ? screen.height - 2 : 1; }
+
+void page_down() {
+  int top = screen.line + page_step();
+  screen_scroll(top, top);
+}
+
+void page_up() {
+  int top = screen.line - page_step();
+  screen_scroll(top, top + screen.height - 1);
+}
+
+// 把非负整数n写到p处，返回写完之后的位置
+char *putint(char *p, int n) {
+  char tmp[16];
+  int i = 0;
+
+  do {
+    tmp[i++] = '0' + n % 10;
+    n /= 10;
+  } while (n > 0);
+  while (i > 0) *p++ = tmp[--i];
+  *p = '\0';
+  return p;
+}
+
+void report_position() {
+  char msg[STATUSBAR_MESSAGE_LENGTH];
+  char *p = msg;
+  int n = line_number(cursor.linebuffer);
+
+  index_all();
+  strcpy(p, "line ");
+  p = putint(p + 5, n);
+  strcpy(p, " of ");
+  p = putint(p + 4, line_count());
+  strcpy(p, " --");
+  p = putint(p + 3, n * 100 / line_count());
+  strcpy(p, "%--");
+  set_statusbar_message(msg);
+}
+
+void input_command(char c) {
+  switch (c) {
+    case KEYCODE_ESC:
+      statusbar_command_end();
+      return;
     case KEYCODE_CR:
     case KEYCODE_LF:
       statusbar_command_exec();
-      statusbar_command_begin();
+      if (command) {
+        statusbar_command_begin();
+      }
       return;
     default:
       if (!ischaracter(c) && c != KEYCODE_DELETE) {
@@ -857,17 +2382,12 @@ void paste_line() {
   if (last_delete_line == NULL) {
     return;
   }
-  last_delete_line->dirty = 2;
-  struct linebuffer *next_line = cursor.linebuffer->next;
-  link_linebuffer(cursor.linebuffer, last_delete_line);
-  link_linebuffer(last_delete_line, next_line);
+  struct linebuffer *new_line = copy_linebuffer(last_delete_line);
+  journal_record_line(EDIT_PUTLINE, cursor.linebuffer, cursor.y + 1, 0,
+                      new_line);
+  line_link(cursor.linebuffer, new_line);
   cursor_down();
   cursor.x = 0;
-
-  struct linebuffer *new_line = create_linebuffer();
-  new_line->size = last_delete_line->size;
-  memcpy(new_line->buf, last_delete_line->buf, LINE_BUFFER_LENGTH);
-  last_delete_line = new_line;
 }
 
 void input_mode_normal(char c) {
@@ -878,6 +2398,14 @@ void input_mode_normal(char c) {
 
   clear_statusbar_message();
 
+  if (pending_g) {
+    pending_g = 0;
+    if (c == 'g') {
+      goto_line(1);
+      return;
+    }
+  }
+
   switch (c) {
     case 'a':
       cursor_right();
@@ -914,11 +2442,9 @@ void input_mode_normal(char c) {
       handle_reverse_find();
       return;
     case 'n':
-      cursor_right();
       find_string();
       return;
     case 'N':
-      cursor_left();
       reverse_find_string();
       return;
     case KEYCODE_CTRL_L:
@@ -927,24 +2453,42 @@ void input_mode_normal(char c) {
     case 'p':
       paste_line();
       return;
+    case 'u':
+      undo();
+      return;
+    case KEYCODE_CTRL_R:
+      redo();
+      return;
+    case 'g':
+      pending_g = 1;
+      return;
+    case 'G':
+      index_all();
+      goto_line(line_count());
+      return;
+    case KEYCODE_CTRL_F:
+      page_down();
+      return;
+    case KEYCODE_CTRL_B:
+      page_up();
+      return;
+    case KEYCODE_CTRL_G:
+      report_position();
+      return;
+    case KEYCODE_CTRL_W:
+      if (nwindow > 1) {
+        window_enter((curwin + 1) % nwindow);
+      }
+      return;
   }
 }
 
 void enter_insert() {
-  struct linebuffer *lbp, *lbpnext;
+  struct linebuffer *lbp;
   lbp = create_linebuffer();
 
-  lbp->size = cursor.linebuffer->size - cursor.x;
-  safestrcpy(lbp->buf, cursor.linebuffer->buf + cursor.x, lbp->size + 1);
-  cursor.linebuffer->size = cursor.x;
-  memset(cursor.linebuffer->buf + cursor.x, '\0',
-         LINE_BUFFER_LENGTH - cursor.x);
-
-  lbpnext = cursor.linebuffer->next;
-  link_linebuffer(cursor.linebuffer, lbp);
-  link_linebuffer(lbp, lbpnext);
-
-  cursor.linebuffer->dirty = 2;
+  journal_record_line(EDIT_SPLIT, cursor.linebuffer, cursor.y, cursor.x, lbp);
+  line_split(cursor.linebuffer, cursor.x, lbp);
   cursor_down();
   cursor.x = 0;
 }
@@ -953,13 +2497,8 @@ void character_insert(char c) {
   if (cursor.linebuffer->size == LINE_BUFFER_LENGTH - 1) {
     return;
   }
-  memmove(cursor.linebuffer->buf + (cursor.x + 1),
-          cursor.linebuffer->buf + cursor.x,
-          cursor.linebuffer->size - cursor.x + 1);
-  cursor.linebuffer->buf[cursor.x] = c;
-
-  cursor.linebuffer->dirty = 1;
-  cursor.linebuffer->size++;
+  journal_record_insert(cursor.linebuffer, cursor.y, cursor.x, c);
+  text_insert(cursor.linebuffer, cursor.x, &c, 1);
   cursor_right();
 }
 
@@ -968,11 +2507,17 @@ void handle_backspace() {
     return;
   }
   if (cursor.x == 0) {
-    if (merge_linebuffer(cursor.linebuffer->prev, cursor.linebuffer) > 0) {
-      int right_size = cursor.linebuffer->size;
-      deleteline_normal();
-      cursor.x = cursor.linebuffer->size - right_size;
+    struct linebuffer *lbp = cursor.linebuffer;
+    struct linebuffer *prev = line_prev(lbp);
+    int x = prev->size;
+    if (x + lbp->size >= LINE_BUFFER_LENGTH) {
+      return;
     }
+    journal_record_line(EDIT_JOIN, prev, cursor.y - 1, x, lbp);
+    line_join(prev, lbp);
+    cursor.linebuffer = lbp->next;
+    cursor_up();
+    cursor.x = x;
     return;
   }
 
@@ -1044,37 +2589,35 @@ void input_hook() {
 
 // init
 void init() {
-  struct linebuffer *lbp;
-  lbp = create_linebuffer();
-
   mode = MODE_NORMAL;
   quit_flg = 0;
-  cursor_init(lbp);
   statusbar_init();
 
   memset(find_str, 0, sizeof(find_str));
+  ac_build();
 
   alloc_linebuffer(&linebuffer_head);
   alloc_linebuffer(&linebuffer_tail);
   linebuffer_head.prev = &linebuffer_head;
   link_linebuffer(&linebuffer_tail, &linebuffer_tail);
-  link_linebuffer(&linebuffer_head, lbp);
-  link_linebuffer(lbp, &linebuffer_tail);
   strcpy(linebuffer_tail.buf, "~");
   linebuffer_tail.size = 1;
 
-  // screen_init: after buffer initialization
-  screen_init();
+  nwindow = 1;
+  curwin = 0;
+  window_layout();
 }
 
 void cleanup() {
-  struct linebuffer *lbp, *lbptmp;
-  lbp = (&linebuffer_tail)->prev;
-  while (lbp != &linebuffer_head) {
-    lbptmp = lbp;
-    lbp = lbp->prev;
-    free(lbptmp->buf);
-    free(lbptmp);
+  struct buffer *b;
+
+  for (b = buffers; b != NULL; b = b->next) {
+    buffer_activate(b);
+    buffer_free_text();
+  }
+  while ((b = buffers) != NULL) {
+    buffers = b->next;
+    free(b);
   }
   free(linebuffer_head.buf);
   free(linebuffer_tail.buf);
@@ -1082,6 +2625,7 @@ void cleanup() {
     free(last_delete_line->buf);
     free(last_delete_line);
   }
+  re_free(search.re);
 }
 
 // main
@@ -1091,15 +2635,15 @@ int main(int argc, char *argv[]) {
   init();
   setviflag();
 
-  if (argc == 2) {
-    strcpy(inputfilename, argv[1]);
-    load();
-  }
+  windows[0].buf = buffer_open(argc == 2 ? argv[1] : "");
 
   while (1) {
     // top = screen_top();
     // display(top);
-    display(screen.upperline);
+    display();
+    // keep indexing the file while waiting for the next key
+    index_more();
+    line_evict();
     input_hook();
 
     if (quit_flg) break;
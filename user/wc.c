@@ -1,53 +1,182 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
+#include "user/jobs.h"
 
-char buf[512];
+char buf[65536] __attribute__((aligned(8)));
+int bench;
 
+// Eight bytes at a time: a mask with the high bit set in every byte
+// equal to c, then the set bits are counted with one multiply.
+typedef uint64 __attribute__((__may_alias__)) word;
+
+#define ONES  0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+
+static inline uint64
+eqbytes(uint64 x, int c)
+{
+  uint64 t;
+
+  x ^= ONES * c;
+  t = (x & ~HIGHS) + ~HIGHS;   // high bit set iff the low 7 bits are not 0
+  return ~(t | x | ~HIGHS);    // exact, no borrow into the next byte
+}
+
+static inline int
+nbytes(uint64 m)
+{
+  return ((m >> 7) * ONES) >> 56;
+}
+
+// The set wc always used: strchr(" \r\t\n\v", c).
+static inline int
+isspace(int c)
+{
+  return c == ' ' || c == '\r' || c == '\t' || c == '\n' || c == '\v';
+}
+
+// Count lines and word starts in p[0..n); *inword carries over between
+// calls. p must be 8-byte aligned.
+void
+count(char *p, int n, int *l, int *w, int *inword)
+{
+  uint64 x, s, nl, prev;
+  int i;
+
+  prev = *inword ? 0 : 0x80;   // was the byte before p a space
+  for(i = 0; i + 8 <= n; i += 8){
+    x = *(word*)(p + i);
+    nl = eqbytes(x, '\n');
+    s = nl | eqbytes(x, ' ') | eqbytes(x, '\r') | eqbytes(x, '\t') | eqbytes(x, '\v');
+    *l += nbytes(nl);
+    // a word starts at a non-space byte whose previous byte is a space
+    *w += nbytes(~s & HIGHS & ((s << 8) | prev));
+    prev = s >> 56;
+  }
+  *inword = !prev;
+  for(; i < n; i++){
+    if(p[i] == '\n')
+      (*l)++;
+    if(isspace(p[i]))
+      *inword = 0;
+    else if(!*inword){
+      (*w)++;
+      *inword = 1;
+    }
+  }
+}
+
+// -b: throughput of the read and count loop
+void
+rate(int c, int t)
+{
+  int v;
+
+  if(t == 0){
+    printf("%d bytes in <1 tick, use a bigger file\n", c);
+    return;
+  }
+  v = (uint64)c * 100 / (1024*1024) / t;   // a tick is about 1/10 s
+  printf("%d bytes in %d ticks, %d.%d MB/s\n", c, t, v / 10, v % 10);
+}
+
+// Count fd, or only the lines of job j when running as a worker.
 void
-wc(int fd, char *name)
+wc(int fd, char *name, struct job *j)
 {
-  int i, n;
+  int n, t;
   int l, w, c, inword;
 
   l = w = c = 0;
   inword = 0;
-  while((n = read(fd, buf, sizeof(buf))) > 0){
-    for(i=0; i<n; i++){
-      c++;
-      if(buf[i] == '\n')
-        l++;
-      if(strchr(" \r\t\n\v", buf[i]))
-        inword = 0;
-      else if(!inword){
-        w++;
-        inword = 1;
-      }
-    }
+  t = uptime();
+  while((n = j ? jobread(j, fd, buf, sizeof(buf)) : read(fd, buf, sizeof(buf))) > 0){
+    count(buf, n, &l, &w, &inword);
+    c += n;
   }
   if(n < 0){
     printf("wc: read error\n");
     exit(1);
   }
-  printf("%d %d %d %s\n", l, w, c, name);
+  t = uptime() - t;
+  if(j)
+    printf("%d %d %d\n", l, w, c);
+  else
+    printf("%d %d %d %s\n", l, w, c, name);
+  if(bench && !j)
+    rate(c, t);
+}
+
+void
+work(struct job *j)
+{
+  int fd;
+
+  if((fd = jobopen(j)) < 0){
+    printf("wc: cannot open %s\n", j->name);
+    exit(1);
+  }
+  wc(fd, j->name, j);
+  close(fd);
+}
+
+int total[3], bytes;
+
+// Chunks end at line boundaries, so no word is split between two.
+void
+collect(struct job *j, int fd)
+{
+  int i, v[3];
+
+  if(jobnums(fd, v, 3) == 3){
+    for(i = 0; i < 3; i++)
+      total[i] += v[i];
+    bytes += v[2];
+  }
+  if(j->last){
+    printf("%d %d %d %s\n", total[0], total[1], total[2], j->name);
+    total[0] = total[1] = total[2] = 0;
+  }
 }
 
 int
 main(int argc, char *argv[])
 {
-  int fd, i;
+  int fd, i, nworker, t;
 
-  if(argc <= 1){
-    wc(0, "");
+  nworker = 1;
+  for(i = 1; i < argc && argv[i][0] == '-'; i++){
+    if(strcmp(argv[i], "-b") == 0)
+      bench = 1;
+    else if(strcmp(argv[i], "-j") == 0 && i+1 < argc &&
+            (nworker = atoi(argv[++i])) >= 1 && nworker <= MAXWORKERS)
+      ;
+    else {
+      fprintf(2, "usage: wc [-b] [-j n] [file ...], n at most %d\n", MAXWORKERS);
+      exit(1);
+    }
+  }
+
+  if(i >= argc){
+    wc(0, "", 0);
     exit(0);
   }
 
-  for(i = 1; i < argc; i++){
+  if(nworker > 1){
+    t = uptime();
+    jobsplit("wc", argv+i, argc-i, nworker, 1);
+    jobrun(nworker, work, collect);
+    if(bench)
+      rate(bytes, uptime() - t);
+    exit(0);
+  }
+  for(; i < argc; i++){
     if((fd = open(argv[i], 0)) < 0){
       printf("wc: cannot open %s\n", argv[i]);
       exit(1);
     }
-    wc(fd, argv[i]);
+    wc(fd, argv[i], 0);
     close(fd);
   }
   exit(0);